@@ -0,0 +1,19 @@
+uniform sampler2D texture;	//compact tile, 0 empty, 1..255 covered with light
+uniform sampler2D material;	//repeated
+uniform vec2 material_size;
+uniform vec2 tile_size;
+uniform vec2 tile_origin;	//island pixel at the tile corner
+uniform float light_limit;
+
+void main() {
+	float v=texture2D(texture,gl_TexCoord[0].xy).a*255.0;
+	if(v<0.5) {
+		gl_FragColor=vec4(0.0);
+		return;
+	}
+	float light=1.0-light_limit+(v-1.0)*(2.0*light_limit/254.0);
+
+	vec2 pos=tile_origin+gl_TexCoord[0].xy*tile_size;
+	vec3 m=texture2D(material,pos/material_size).rgb;
+	gl_FragColor=vec4(m*light,1.0)*gl_Color;
+}
@@ -0,0 +1,51 @@
+uniform sampler2D texture;	//cell map, alpha 1 for active cells
+uniform sampler2D noise;	//noise_map+0.5 as 24 bit fixed point, high byte in red, repeated
+uniform sampler2D material;	//repeated
+uniform vec2 noise_size;
+uniform vec2 material_size;
+uniform vec2 cell_count;
+uniform vec2 noise_offset;
+uniform float cell_size;
+uniform float light_weight;
+uniform float light_limit;
+
+//TerrainIsland::light_radius.x, the island only uses this shader when they match
+const int light_radius=5;
+
+float cell(vec2 c) {
+	return texture2D(texture,(c+0.5)/cell_count).a;
+}
+//island pixel p covered, same as TerrainIsland::raster_area
+float covered(vec2 p) {
+	vec2 c=floor(p/cell_size);
+	vec2 c2=min(c+1.0,cell_count-1.0);
+	vec2 l=(p-c*cell_size)/cell_size;
+	float left=mix(cell(c),cell(vec2(c.x,c2.y)),l.y);
+	float right=mix(cell(vec2(c2.x,c.y)),cell(c2),l.y);
+	vec3 nb=floor(texture2D(noise,(p+noise_offset+0.5)/noise_size).rgb*255.0+0.5);
+	float n=dot(nb,vec3(65536.0,256.0,1.0))/16777216.0-0.5;
+	return (mix(left,right,l.x)+n>0.5) ? 1.0 : 0.0;
+}
+//edge columns count as empty for lighting, same as TerrainIsland::shade_area
+float solid(vec2 p) {
+	if(p.x<1.0 || p.x>=cell_count.x*cell_size) {
+		return 0.0;
+	}
+	return covered(p);
+}
+
+void main() {
+	vec2 p=floor(gl_TexCoord[0].xy*cell_count*cell_size);
+	if(covered(p)==0.0) {
+		gl_FragColor=vec4(0.0);
+		return;
+	}
+	float empty=0.0;	//left minus right
+	for(int i=1;i<=light_radius;i++) {
+		empty+=solid(p+vec2(float(i),0.0))-solid(p-vec2(float(i),0.0));
+	}
+	float light=clamp(1.0+light_weight*empty,1.0-light_limit,1.0+light_limit);
+
+	vec3 m=texture2D(material,(p+0.5)/material_size).rgb;
+	gl_FragColor=vec4(m*light,1.0)*gl_Color;
+}
@@ -0,0 +1,397 @@
+#ifndef _BGA_AABBTREE_H_
+#define _BGA_AABBTREE_H_
+
+#include <stdint.h>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <SFML/System/Vector2.hpp>
+
+#include "Quad.h"
+#include "SimpleList.h"
+
+//dynamic bounding volume tree
+//leaves store fat bboxes so small movements don't touch the tree, inner nodes keep group union for pruning
+template<class T>
+class AABBTree {
+
+	class Node {
+	public:
+		Quad bbox;
+		T item;
+		uint32_t group;
+		int parent;		//next free node when unused
+		int child1;
+		int child2;
+		int height;		//leaf 0, unused -1
+
+		bool is_leaf() const {
+			return (child1==-1);
+		}
+	};
+
+	std::vector<Node> nodes;
+	int root;
+	int free_list;
+	int proxy_count;
+	float fat_margin;
+
+	std::vector<int> stack;
+
+	static Quad combine(const Quad& a,const Quad& b) {
+		return Quad(sf::Vector2f(std::min(a.p1.x,b.p1.x),std::min(a.p1.y,b.p1.y)),
+				sf::Vector2f(std::max(a.p2.x,b.p2.x),std::max(a.p2.y,b.p2.y)));
+	}
+	static float perimeter(const Quad& q) {
+		return (q.p2.x-q.p1.x)+(q.p2.y-q.p1.y);
+	}
+	static bool bbox_contains(const Quad& outer,const Quad& inner) {
+		return (outer.p1.x<=inner.p1.x && outer.p1.y<=inner.p1.y &&
+				outer.p2.x>=inner.p2.x && outer.p2.y>=inner.p2.y);
+	}
+
+	int allocate_node() {
+		if(free_list==-1) {
+			Node n;
+			n.parent=-1;
+			n.child1=-1;
+			n.child2=-1;
+			n.height=-1;
+			n.group=0;
+			nodes.push_back(n);
+			free_list=nodes.size()-1;
+		}
+		int id=free_list;
+		free_list=nodes[id].parent;
+		nodes[id].parent=-1;
+		nodes[id].child1=-1;
+		nodes[id].child2=-1;
+		nodes[id].height=0;
+		nodes[id].group=0;
+		return id;
+	}
+	void free_node(int id) {
+		nodes[id].parent=free_list;
+		nodes[id].height=-1;
+		free_list=id;
+	}
+
+	void refit(int id) {
+		Node& n=nodes[id];
+		const Node& c1=nodes[n.child1];
+		const Node& c2=nodes[n.child2];
+		n.bbox=combine(c1.bbox,c2.bbox);
+		n.group=(c1.group|c2.group);
+		n.height=1+std::max(c1.height,c2.height);
+	}
+
+	//single AVL style rotation, returns new subtree root
+	int balance(int a) {
+		Node& na=nodes[a];
+		if(na.is_leaf() || na.height<2) {
+			return a;
+		}
+		int b=na.child1;
+		int c=na.child2;
+		int diff=nodes[c].height-nodes[b].height;
+
+		if(diff>1) {
+			return rotate(a,c);
+		}
+		if(diff<-1) {
+			return rotate(a,b);
+		}
+		return a;
+	}
+	//lift child "up" above a
+	int rotate(int a,int up) {
+		int f=nodes[up].child1;
+		int g=nodes[up].child2;
+
+		nodes[up].child1=a;
+		nodes[up].parent=nodes[a].parent;
+		nodes[a].parent=up;
+
+		if(nodes[up].parent!=-1) {
+			Node& p=nodes[nodes[up].parent];
+			if(p.child1==a) {
+				p.child1=up;
+			}
+			else {
+				p.child2=up;
+			}
+		}
+		else {
+			root=up;
+		}
+
+		//keep the taller grandchild next to a's old sibling
+		int keep=f;
+		int move=g;
+		if(nodes[f].height<nodes[g].height) {
+			keep=g;
+			move=f;
+		}
+		nodes[up].child2=keep;
+		if(nodes[a].child1==up) {
+			nodes[a].child1=move;
+		}
+		else {
+			nodes[a].child2=move;
+		}
+		nodes[move].parent=a;
+
+		refit(a);
+		refit(up);
+		return up;
+	}
+
+	void insert_leaf(int leaf) {
+		if(root==-1) {
+			root=leaf;
+			nodes[root].parent=-1;
+			return;
+		}
+
+		//pick sibling by perimeter cost
+		const Quad leaf_bbox=nodes[leaf].bbox;
+		int index=root;
+		while(!nodes[index].is_leaf()) {
+			const Node& n=nodes[index];
+			float area=perimeter(n.bbox);
+			float combined_area=perimeter(combine(n.bbox,leaf_bbox));
+
+			float cost=2.0f*combined_area;
+			float inheritance_cost=2.0f*(combined_area-area);
+
+			float cost1=perimeter(combine(leaf_bbox,nodes[n.child1].bbox))+inheritance_cost;
+			if(!nodes[n.child1].is_leaf()) {
+				cost1-=perimeter(nodes[n.child1].bbox);
+			}
+			float cost2=perimeter(combine(leaf_bbox,nodes[n.child2].bbox))+inheritance_cost;
+			if(!nodes[n.child2].is_leaf()) {
+				cost2-=perimeter(nodes[n.child2].bbox);
+			}
+
+			if(cost<cost1 && cost<cost2) {
+				break;
+			}
+			index=(cost1<cost2) ? n.child1 : n.child2;
+		}
+
+		int sibling=index;
+		int old_parent=nodes[sibling].parent;
+		int new_parent=allocate_node();
+		nodes[new_parent].parent=old_parent;
+		nodes[new_parent].child1=sibling;
+		nodes[new_parent].child2=leaf;
+		nodes[sibling].parent=new_parent;
+		nodes[leaf].parent=new_parent;
+		refit(new_parent);
+
+		if(old_parent!=-1) {
+			if(nodes[old_parent].child1==sibling) {
+				nodes[old_parent].child1=new_parent;
+			}
+			else {
+				nodes[old_parent].child2=new_parent;
+			}
+		}
+		else {
+			root=new_parent;
+		}
+
+		refit_up(nodes[leaf].parent);
+	}
+
+	void remove_leaf(int leaf) {
+		if(leaf==root) {
+			root=-1;
+			return;
+		}
+		int parent=nodes[leaf].parent;
+		int grand_parent=nodes[parent].parent;
+		int sibling=(nodes[parent].child1==leaf) ? nodes[parent].child2 : nodes[parent].child1;
+
+		if(grand_parent!=-1) {
+			if(nodes[grand_parent].child1==parent) {
+				nodes[grand_parent].child1=sibling;
+			}
+			else {
+				nodes[grand_parent].child2=sibling;
+			}
+			nodes[sibling].parent=grand_parent;
+			free_node(parent);
+			refit_up(grand_parent);
+		}
+		else {
+			root=sibling;
+			nodes[sibling].parent=-1;
+			free_node(parent);
+		}
+	}
+
+	void refit_up(int index) {
+		while(index!=-1) {
+			index=balance(index);
+			refit(index);
+			index=nodes[index].parent;
+		}
+	}
+
+	//clips segment p1+d*t against bbox, t in [0,max_t]
+	static bool segment_hits_bbox(const sf::Vector2f& p1,const sf::Vector2f& d,const Quad& bbox,float max_t) {
+		float t_min=0.0f;
+		float t_max=max_t;
+		const float p[2]={p1.x,p1.y};
+		const float dir[2]={d.x,d.y};
+		const float lo[2]={bbox.p1.x,bbox.p1.y};
+		const float hi[2]={bbox.p2.x,bbox.p2.y};
+
+		for(int i=0;i<2;i++) {
+			if(std::fabs(dir[i])<1e-9f) {
+				if(p[i]<lo[i] || p[i]>hi[i]) {
+					return false;
+				}
+				continue;
+			}
+			float inv=1.0f/dir[i];
+			float t1=(lo[i]-p[i])*inv;
+			float t2=(hi[i]-p[i])*inv;
+			if(t1>t2) {
+				std::swap(t1,t2);
+			}
+			t_min=std::max(t_min,t1);
+			t_max=std::min(t_max,t2);
+			if(t_min>t_max) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+public:
+
+	AABBTree(float _fat_margin=16.0f) {
+		root=-1;
+		free_list=-1;
+		proxy_count=0;
+		fat_margin=_fat_margin;
+	}
+
+	int size() const {
+		return proxy_count;
+	}
+
+	int create_proxy(const Quad& bbox,const T& item,uint32_t group) {
+		int id=allocate_node();
+		Node& n=nodes[id];
+		n.bbox=bbox;
+		n.bbox.p1-=sf::Vector2f(fat_margin,fat_margin);
+		n.bbox.p2+=sf::Vector2f(fat_margin,fat_margin);
+		n.item=item;
+		n.group=group;
+		n.height=0;
+		insert_leaf(id);
+		proxy_count++;
+		return id;
+	}
+	void destroy_proxy(int id) {
+		remove_leaf(id);
+		free_node(id);
+		proxy_count--;
+	}
+	//reinserts only when bbox leaves the fat bbox, returns true if the tree changed
+	bool move_proxy(int id,const Quad& bbox,uint32_t group) {
+		if(nodes[id].group!=group) {
+			nodes[id].group=group;
+			for(int p=nodes[id].parent;p!=-1;p=nodes[p].parent) {
+				refit(p);
+			}
+		}
+		if(bbox_contains(nodes[id].bbox,bbox)) {
+			return false;
+		}
+		remove_leaf(id);
+		nodes[id].bbox=bbox;
+		nodes[id].bbox.p1-=sf::Vector2f(fat_margin,fat_margin);
+		nodes[id].bbox.p2+=sf::Vector2f(fat_margin,fat_margin);
+		insert_leaf(id);
+		return true;
+	}
+	const Quad& get_fat_bbox(int id) const {
+		return nodes[id].bbox;
+	}
+
+	//items whose fat bbox intersects quad and whose group matches group_mask, appended to out
+	void query_aabb(const Quad& quad,uint32_t group_mask,SimpleList<T>& out) {
+		if(root==-1) {
+			return;
+		}
+		stack.clear();
+		stack.push_back(root);
+		while(!stack.empty()) {
+			int id=stack.back();
+			stack.pop_back();
+			const Node& n=nodes[id];
+			if(!(n.group&group_mask) || !n.bbox.intersects(quad)) {
+				continue;
+			}
+			if(n.is_leaf()) {
+				out.push_back(n.item);
+			}
+			else {
+				stack.push_back(n.child1);
+				stack.push_back(n.child2);
+			}
+		}
+	}
+	void query_point(const sf::Vector2f& pos,uint32_t group_mask,SimpleList<T>& out) {
+		query_aabb(Quad(pos,pos),group_mask,out);
+	}
+
+	//first hit along p1->p2, positions are parametric [0,1]
+	//fn(item,max_t,out_t) does the exact test and returns true for hits closer than max_t
+	template<class F>
+	bool raycast(const sf::Vector2f& p1,const sf::Vector2f& p2,uint32_t group_mask,F fn,
+			T& out_item,float& out_position,float max_position=1.0f) {
+		if(root==-1) {
+			return false;
+		}
+		sf::Vector2f d=p2-p1;
+		bool hit=false;
+
+		stack.clear();
+		stack.push_back(root);
+		while(!stack.empty()) {
+			int id=stack.back();
+			stack.pop_back();
+			const Node& n=nodes[id];
+			if(!(n.group&group_mask) || !segment_hits_bbox(p1,d,n.bbox,max_position)) {
+				continue;
+			}
+			if(n.is_leaf()) {
+				float t;
+				if(fn(n.item,max_position,t)) {
+					hit=true;
+					max_position=t;
+					out_item=n.item;
+					if(t<=0.0f) {
+						break;
+					}
+				}
+			}
+			else {
+				stack.push_back(n.child1);
+				stack.push_back(n.child2);
+			}
+		}
+		if(hit) {
+			out_position=max_position;
+		}
+		return hit;
+	}
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef _BGA_CONTACTCACHE_H_
+#define _BGA_CONTACTCACHE_H_
+
+#include <stdint.h>
+#include <utility>
+#include <functional>
+#include <unordered_map>
+
+//persistent contacts between pairs of items, a pair is unordered
+//touch() every tick the pair overlaps, end_tick() drops pairs that weren't touched
+template<class T>
+class ContactCache {
+public:
+	enum Event {
+		CONTACT_ENTER,	//first tick of the contact
+		CONTACT_STAY,
+	};
+
+private:
+	typedef std::pair<T,T> Key;
+
+	class KeyHash {
+	public:
+		std::size_t operator()(const Key& k) const {
+			std::size_t h1=std::hash<T>()(k.first);
+			std::size_t h2=std::hash<T>()(k.second);
+			return h1^(h2+0x9e3779b9+(h1<<6)+(h1>>2));
+		}
+	};
+
+	std::unordered_map<Key,uint32_t,KeyHash> contacts;	//last tick touched
+	uint32_t tick;
+
+	static Key make_key(T a,T b) {
+		if(std::less<T>()(b,a)) {
+			return Key(b,a);
+		}
+		return Key(a,b);
+	}
+
+public:
+	ContactCache() {
+		tick=1;
+	}
+
+	Event touch(T a,T b) {
+		std::pair<typename std::unordered_map<Key,uint32_t,KeyHash>::iterator,bool> res=
+				contacts.insert(std::make_pair(make_key(a,b),tick));
+		if(res.second) {
+			return CONTACT_ENTER;
+		}
+		res.first->second=tick;
+		return CONTACT_STAY;
+	}
+	bool has(T a,T b) const {
+		return (contacts.find(make_key(a,b))!=contacts.end());
+	}
+
+	//pairs not touched since the last end_tick() end, touching them again is a new enter
+	void end_tick() {
+		for(typename std::unordered_map<Key,uint32_t,KeyHash>::iterator it=contacts.begin();it!=contacts.end();) {
+			if(it->second!=tick) {
+				it=contacts.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+		tick++;
+	}
+	//drop all contacts of a removed item
+	void remove(T item) {
+		for(typename std::unordered_map<Key,uint32_t,KeyHash>::iterator it=contacts.begin();it!=contacts.end();) {
+			if(it->first.first==item || it->first.second==item) {
+				it=contacts.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+	}
+	void clear() {
+		contacts.clear();
+	}
+	int size() const {
+		return contacts.size();
+	}
+};
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef _BGA_FORCEFIELD_H_
+#define _BGA_FORCEFIELD_H_
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <SFML/Graphics/Rect.hpp>
+#include <SFML/System/Vector2.hpp>
+
+//coarse velocity field over a world rect, cleared and re-splatted every tick
+//each cell keeps the summed velocity of the sources covering its center and their count
+class ForceField {
+
+	class Cell {
+	public:
+		sf::Vector2f vel;
+		float weight;
+	};
+
+	std::vector<Cell> cells;
+	int w;
+	int h;
+	float cell_size;
+	sf::Vector2f origin;
+	bool empty;
+
+	const Cell* cell(int x,int y) const {
+		if(x<0 || y<0 || x>=w || y>=h) {
+			return nullptr;
+		}
+		return &cells[y*w+x];
+	}
+
+public:
+
+	ForceField(float _cell_size=32.0f) {
+		w=0;
+		h=0;
+		cell_size=_cell_size;
+		empty=true;
+	}
+
+	//covers area, all cells zero
+	void reset(const sf::FloatRect& area) {
+		origin=sf::Vector2f(area.left,area.top);
+		w=std::max(1,(int)std::ceil(area.width/cell_size));
+		h=std::max(1,(int)std::ceil(area.height/cell_size));
+
+		Cell zero;
+		zero.weight=0;
+		cells.assign(w*h,zero);
+		empty=true;
+	}
+	bool is_empty() const {
+		return empty;
+	}
+
+	//pull towards center, speed lerped from power_center to power_edge over squared distance
+	void splat_radial(const sf::Vector2f& center,float radius,float power_center,float power_edge) {
+		float r2=radius*radius;
+
+		int x1=std::max(0,(int)std::floor((center.x-radius-origin.x)/cell_size));
+		int y1=std::max(0,(int)std::floor((center.y-radius-origin.y)/cell_size));
+		int x2=std::min(w-1,(int)std::floor((center.x+radius-origin.x)/cell_size));
+		int y2=std::min(h-1,(int)std::floor((center.y+radius-origin.y)/cell_size));
+
+		for(int y=y1;y<=y2;y++) {
+			for(int x=x1;x<=x2;x++) {
+				sf::Vector2f diff=center-(origin+sf::Vector2f(x+0.5f,y+0.5f)*cell_size);
+				float dist2=diff.x*diff.x+diff.y*diff.y;
+				if(dist2>=r2) {
+					continue;
+				}
+				Cell& c=cells[y*w+x];
+				c.weight+=1.0f;
+				empty=false;
+
+				if(dist2>0.0f) {
+					float t=dist2/r2;
+					float speed=power_center+(power_edge-power_center)*t;
+					c.vel+=diff/std::sqrt(dist2)*speed;
+				}
+			}
+		}
+	}
+
+	//bilinear lookup between cell centers, false where less than half covered by sources
+	//overlapping sources are averaged
+	bool sample(const sf::Vector2f& pos,sf::Vector2f& out_vel) const {
+		if(empty) {
+			return false;
+		}
+		float fx=(pos.x-origin.x)/cell_size-0.5f;
+		float fy=(pos.y-origin.y)/cell_size-0.5f;
+		int x=(int)std::floor(fx);
+		int y=(int)std::floor(fy);
+		float tx=fx-x;
+		float ty=fy-y;
+
+		sf::Vector2f vel;
+		float weight=0;
+
+		const Cell* c[4]={cell(x,y),cell(x+1,y),cell(x,y+1),cell(x+1,y+1)};
+		float k[4]={(1-tx)*(1-ty),tx*(1-ty),(1-tx)*ty,tx*ty};
+		for(int i=0;i<4;i++) {
+			if(c[i]) {
+				vel+=c[i]->vel*k[i];
+				weight+=c[i]->weight*k[i];
+			}
+		}
+		if(weight<0.5f) {
+			return false;
+		}
+		out_vel=vel/weight;
+		return true;
+	}
+};
+
+#endif
@@ -9,6 +9,7 @@
 #include <functional>
 #include <sstream>
 #include <array>
+#include <limits>
 
 #include <SFML/System.hpp>
 
@@ -19,6 +20,11 @@
 #include "Terrain.h"
 #include "Quad.h"
 #include "SimpleList.h"
+#include "SpatialHash.h"
+#include "AABBTree.h"
+#include "ParallelFor.h"
+#include "ContactCache.h"
+#include "ForceField.h"
 #include "Easing.h"
 
 //utils
@@ -406,7 +412,8 @@ public:
 	bool bounce;			//bounce off entities
 	bool terrain_bounce;
 
-	Quad bbox;
+	Quad bbox;		//world space, updated with the spatial indices
+	int tree_proxy;	//Game::shape_tree leaf, -1 if not inserted
 	bool enabled;
 
 	float hit_damage;	//how much damage is done to the colliding entity
@@ -417,6 +424,7 @@ public:
 	CompShape() {
 		collision_group=1;
 		collision_mask=0xff;
+		tree_proxy=-1;
 		enabled=true;
 		bounce=false;
 		terrain_bounce=false;
@@ -1572,6 +1580,7 @@ class Game : public Menu {
 						Texture texture=isl->generate_icon_texture();
 
 						if(texture.tex==nullptr) {
+							terrain->request_generation(isl,TerrainLoaderTask::PRIORITY_INIT);
 							continue;
 						}
 
@@ -1661,6 +1670,30 @@ class Game : public Menu {
 
 	EntityManager entities;
 
+	//broadphase indices, rebuilt after every entities.update()
+	SpatialHash<CompShape*> shape_index;
+	SpatialHash<Entity*> entity_index;
+	AABBTree<CompShape*> shape_tree;	//for rays and points, refitted instead of rebuilt
+	SimpleList<CompShape*> shape_query;
+	SimpleList<Entity*> entity_query;
+	float spatial_index_margin;	//entities move during the tick, queries are padded by this
+
+	//overlapping quads of two shapes, found by the parallel collision pass
+	class ShapeContact {
+	public:
+		int shape1;
+		int quad1;
+		int shape2;
+	};
+	ParallelFor workers;
+	std::vector<CompShape*> collision_shapes;
+	std::vector<int> collision_task_begin;
+	std::vector<std::vector<ShapeContact> > collision_contacts;	//per task, in shape order
+	ContactCache<CompShape*> shape_contacts;	//shape pairs, terrain contacts are paired with nullptr
+
+	ForceField gravity_field;		//gravity sources around the camera
+	float gravity_field_margin;		//sources and enemies this far off screen still count
+
 	Entity* player;
 
 	std::vector<Graphic> graphic_explosion;
@@ -1669,6 +1702,7 @@ class Game : public Menu {
 	std::vector<Graphic> graphic_enemy_shooter_down;
 	std::vector<Graphic> graphic_enemy_shooter_side;
 	Graphic graphic_engine;
+	Graphic graphic_gravity_force;
 	std::vector<Graphic> graphic_missile;
 
 	NodeShader shader_damage;
@@ -1745,6 +1779,15 @@ public:
 	}
 	void component_removed(Component* c) {
 
+		if(c->type==Component::TYPE_SHAPE) {
+			CompShape* shape=(CompShape*)c;
+			shape_contacts.remove(shape);
+			if(shape->tree_proxy!=-1) {
+				shape_tree.destroy_proxy(shape->tree_proxy);
+				shape->tree_proxy=-1;
+			}
+		}
+
 		if(c->type==Component::TYPE_SHOW_ON_MINIMAP) {
 			CompShowOnMinimap* comp=(CompShowOnMinimap*)c;
 			minimap.items.remove_child(&comp->node);
@@ -1813,6 +1856,7 @@ public:
 		time_scale=1.0;
 		//snap_sprites_to_pixels=true;
 
+		terrain.open_world_file("world.cache");
 		minimap.terrain=&terrain;
 
 		entities.on_component_added= [=](Component* c) { this->component_added(c); };
@@ -1856,6 +1900,7 @@ public:
 
 		//populate some assets
 		graphic_engine=Graphic(Animation(Loader::get_texture("general assets/engine fire.png"),10,13,0.05));
+		graphic_gravity_force=Graphic(Loader::get_texture("general assets/gravity_force.png"));
 		const char* explosion_texture_names[]={"general assets/explosions.png",/*"explosions1.png",*/NULL};
 		for(int t=0;explosion_texture_names[t];t++) {
 			Texture tex_explosions=Loader::get_texture(explosion_texture_names[t]);
@@ -2026,6 +2071,9 @@ public:
 
 		player=NULL;
 
+		spatial_index_margin=32.0f;
+		gravity_field_margin=512.0f;
+
 	}
 	//Node cam_border[4];
 	//Node tmp_node;
@@ -2047,6 +2095,7 @@ public:
 			entity_remove(e);
 		}
 		entities.update();
+		spatial_index_update();
 
 		const char* help_texts[]={
 				"Bastion\nMouse - cannon\nQ - shield\nE - attract\nR - candy mine\nSPACE - hammer",
@@ -2181,6 +2230,15 @@ public:
 		CompTimeout* t=(CompTimeout*)entities.component_add(entity,Component::TYPE_TIMEOUT);
 		t->set(action,timeout);
 	}
+	//restarts the entity's bounce, reusing its bounce component
+	void entity_bounce(Entity* entity,sf::Vector2f vel) {
+		CompBounce* c_bounce=(CompBounce*)entities.component_get(entity,Component::TYPE_BOUNCE);
+		if(!c_bounce) {
+			c_bounce=(CompBounce*)entities.component_add(entity,Component::TYPE_BOUNCE);
+		}
+		c_bounce->timer.reset(0.3);
+		c_bounce->vel=vel;
+	}
 	void entity_add_health(Entity* entity,float health) {
 		if(!entity->comp_health) {
 			entities.component_add(entity,Component::TYPE_HEALTH);
@@ -3236,6 +3294,178 @@ public:
 	}
 	*/
 
+	//entity index group, one bit per attribute and side
+	static uint32_t entity_group(Entity::Attribute attr,bool player_side) {
+		return 1u<<(attr*2+(player_side ? 1 : 0));
+	}
+	static uint32_t entity_group(Entity::Attribute attr) {
+		return entity_group(attr,false)|entity_group(attr,true);
+	}
+
+	//shapes are indexed by world bbox and collision group,
+	//entities by position, once for every indexed attribute
+	void spatial_index_update() {
+		shape_index.clear();
+		for(Component* comp : entities.component_list(Component::TYPE_SHAPE)) {
+			CompShape* shape=(CompShape*)comp;
+			if(!shape->entity || shape->quads.empty()) {
+				continue;
+			}
+			Quad bbox=shape->quads[0];
+			for(const Quad& q : shape->quads) {
+				bbox.p1.x=std::min(bbox.p1.x,q.p1.x);
+				bbox.p1.y=std::min(bbox.p1.y,q.p1.y);
+				bbox.p2.x=std::max(bbox.p2.x,q.p2.x);
+				bbox.p2.y=std::max(bbox.p2.y,q.p2.y);
+			}
+			bbox.translate(shape->entity->pos);
+			shape->bbox=bbox;
+			shape_index.insert(bbox,shape,shape->collision_group);
+
+			bbox.p1-=sf::Vector2f(1,1)*spatial_index_margin;
+			bbox.p2+=sf::Vector2f(1,1)*spatial_index_margin;
+			if(shape->tree_proxy==-1) {
+				shape->tree_proxy=shape_tree.create_proxy(bbox,shape,shape->collision_group);
+			}
+			else {
+				shape_tree.move_proxy(shape->tree_proxy,bbox,shape->collision_group);
+			}
+		}
+
+		entity_index.clear();
+		Entity::Attribute attrs[]={Entity::ATTRIBUTE_ENEMY,Entity::ATTRIBUTE_FRIENDLY,Entity::ATTRIBUTE_ATTRACT};
+		for(Entity::Attribute attr : attrs) {
+			for(Entity* e : entities.attribute_list_entities(attr)) {
+				entity_index.insert(Quad(e->pos,e->pos),e,entity_group(attr,e->player_side));
+			}
+		}
+	}
+
+	//first enabled shape hit along p1->p2 with a collision_group in mask that accepts group
+	//hit_position is parametric, pass the current closest hit (1.0 for none)
+	CompShape* shape_raycast(const sf::Vector2f& p1,const sf::Vector2f& p2,uint8_t group,uint8_t mask,float& hit_position) {
+		CompShape* hit_shape=nullptr;
+		shape_tree.raycast(p1,p2,mask,[&](CompShape* shape,float max_pos,float& out_pos) -> bool {
+			if(!shape->enabled || !shape->entity || (group&shape->collision_mask)==0) {
+				return false;
+			}
+			bool hit=false;
+			for(Quad q : shape->quads) {
+				q.translate(shape->entity->pos);
+				bool p1_inside=false;
+				float pos=1.0f;
+				if(Utils::line_quad_intersection(p1,p2,q,pos,p1_inside)) {
+					if(p1_inside) {
+						out_pos=0.0f;
+						return true;
+					}
+					if(pos<max_pos) {
+						max_pos=pos;
+						out_pos=pos;
+						hit=true;
+					}
+				}
+			}
+			return hit;
+		},hit_shape,hit_position,hit_position);
+		return hit_shape;
+	}
+
+	//collects overlapping quad pairs of collision_shapes
+	//shape ranges per task are fixed by shape count, so the contact order never depends on thread count
+	void collision_gather() {
+		int count=collision_shapes.size();
+		int task_count=(count<64) ? 1 : 32;
+
+		//balance the triangular pair loop
+		collision_task_begin.resize(task_count+1);
+		collision_task_begin[0]=0;
+		double pairs_total=(double)count*(double)(count-1)*0.5;
+		double pairs=0;
+		int shape_i=0;
+		for(int task=1;task<task_count;task++) {
+			double target=pairs_total*task/task_count;
+			while(shape_i<count && pairs<target) {
+				pairs+=count-1-shape_i;
+				shape_i++;
+			}
+			collision_task_begin[task]=shape_i;
+		}
+		collision_task_begin[task_count]=count;
+
+		collision_contacts.resize(task_count);
+		for(std::vector<ShapeContact>& list : collision_contacts) {
+			list.clear();
+		}
+
+		workers.run(task_count,[this](int task) {
+			std::vector<ShapeContact>& out=collision_contacts[task];
+			int count=collision_shapes.size();
+
+			for(int shape_i1=collision_task_begin[task];shape_i1<collision_task_begin[task+1];shape_i1++) {
+				CompShape* shape=collision_shapes[shape_i1];
+				Entity* e=shape->entity;
+				if(!shape->enabled) {
+					continue;
+				}
+				for(std::size_t quad_i=0;quad_i<shape->quads.size();quad_i++) {
+					Quad q2=shape->quads[quad_i];
+					q2.translate(e->pos);
+
+					for(int shape_i2=shape_i1+1;shape_i2<count;shape_i2++) {
+						CompShape* shape2=collision_shapes[shape_i2];
+						Entity* ce=shape2->entity;
+
+						if(ce==e) {
+							continue;
+						}
+						if( (shape->collision_group&shape2->collision_mask)==0 ||
+								(shape2->collision_group&shape->collision_mask)==0) {
+							continue;
+						}
+
+						for(const Quad& cq : shape2->quads) {
+							Quad cq2=cq;
+							cq2.translate(ce->pos);
+
+							if(q2.intersects(cq2)) {
+								ShapeContact c;
+								c.shape1=shape_i1;
+								c.quad1=quad_i;
+								c.shape2=shape_i2;
+								out.push_back(c);
+							}
+						}
+					}
+				}
+			}
+		});
+	}
+
+	//next gathered contact of quad of shape, advancing task and i past it
+	//contacts ordered before it are skipped, e.g. those of a shape disabled after gathering
+	const ShapeContact* contact_next(std::size_t& task,std::size_t& i,int shape,int quad) {
+		while(task<collision_contacts.size()) {
+			const std::vector<ShapeContact>& list=collision_contacts[task];
+			if(i>=list.size()) {
+				task++;
+				i=0;
+				continue;
+			}
+			const ShapeContact& c=list[i];
+			if(c.shape1<shape || (c.shape1==shape && c.quad1<quad)) {
+				i++;
+				continue;
+			}
+			if(c.shape1!=shape || c.quad1!=quad) {
+				return NULL;
+			}
+			i++;
+			return &c;
+		}
+		return NULL;
+	}
+
 	void add_big_explosion(sf::Vector2f pos,bool player_side) {
 		float radius=150.0f;
 		float radius2=radius*radius;
@@ -3252,12 +3482,16 @@ public:
 		sf::Vector2f d_pos=pos-d_size*0.5f;
 		terrain.damage_area(sf::FloatRect(d_pos,d_size),100);
 
-		for(Component* comp : entities.component_list(Component::TYPE_SHAPE)) {
-			if(((CompShape*)comp)->enabled && comp->entity->player_side!=player_side) {
-				float dist=Utils::vec_length_fast(comp->entity->pos-pos);
+		//local list, entity_damage can chain into another explosion
+		SimpleList<CompShape*> shapes;
+		shape_index.query_radius(pos,radius+spatial_index_margin,0xffffffff,shapes);
+		for(int i=0;i<shapes.size();i++) {
+			CompShape* shape=shapes[i];
+			if(shape->enabled && shape->entity && shape->entity->player_side!=player_side) {
+				float dist=Utils::vec_length_fast(shape->entity->pos-pos);
 
 				if(dist<radius2) {
-					entity_damage(comp->entity,Utils::lerp(500,0,dist/radius2));
+					entity_damage(shape->entity,Utils::lerp(500,0,dist/radius2));
 				}
 			}
 		}
@@ -3469,12 +3703,14 @@ public:
 
 	void launch_missiles(int count,sf::Vector2f pos,bool player_side) {
 
-		const std::vector<Entity*>& targets=entities.attribute_list_entities(
-				player_side ? Entity::ATTRIBUTE_ENEMY : Entity::ATTRIBUTE_FRIENDLY);
+		entity_query.clear();
+		entity_index.query_radius(pos,300+spatial_index_margin,
+				entity_group(player_side ? Entity::ATTRIBUTE_ENEMY : Entity::ATTRIBUTE_FRIENDLY),entity_query);
 
 		std::vector<Entity*> targeted;
 
-		for(Entity * e : targets) {
+		for(int i=0;i<entity_query.size();i++) {
+			Entity* e=entity_query[i];
 			if(Utils::vec_length_fast(pos-e->pos)<300*300) {
 				targeted.push_back(e);
 			}
@@ -3623,16 +3859,25 @@ public:
 			}
 		}
 
-		const std::vector<Component*>& list_shape=entities.component_list(Component::TYPE_SHAPE);
-		for(std::size_t shape_i1=0;shape_i1<list_shape.size();shape_i1++) {
-			CompShape* shape=(CompShape*)list_shape[shape_i1];
+		//shape collisions, contacts are gathered in parallel and applied here in shape order
+		collision_shapes.clear();
+		for(Component* comp : entities.component_list(Component::TYPE_SHAPE)) {
+			collision_shapes.push_back((CompShape*)comp);
+		}
+		collision_gather();
+
+		std::size_t contact_task=0;
+		std::size_t contact_i=0;
+
+		for(std::size_t shape_i1=0;shape_i1<collision_shapes.size();shape_i1++) {
+			CompShape* shape=collision_shapes[shape_i1];
 			Entity* e=shape->entity;
 
 			if(!shape->enabled) {
 				continue;
 			}
-			for(const Quad& q : shape->quads) {
-				Quad q2=q;
+			for(std::size_t quad_i=0;quad_i<shape->quads.size();quad_i++) {
+				Quad q2=shape->quads[quad_i];
 				q2.translate(e->pos);
 
 				//terrain collision
@@ -3642,69 +3887,56 @@ public:
 					sf::FloatRect r(q2.p1,q_size);
 					sf::Vector2f col_normal;
 					if(terrain.check_collision(r,col_normal)) {
-						terrain.damage_area(r,20);
-
-						entity_damage(e,10.0f*shape->take_damage_terrain_mult);
+						//damage once per contact, bounce while still moving into the terrain
+						bool enter=(shape_contacts.touch(shape,nullptr)==ContactCache<CompShape*>::CONTACT_ENTER);
+						if(enter) {
+							terrain.damage_area(r,20);
+							entity_damage(e,10.0f*shape->take_damage_terrain_mult);
+						}
 
-						if(shape->terrain_bounce) {
-							CompBounce* c_bounce=(CompBounce*)entities.component_add(e,Component::TYPE_BOUNCE);
-							c_bounce->timer.reset(0.3);
-							c_bounce->vel=Utils::vec_reflect(e->vel,col_normal);
+						if(shape->terrain_bounce && (enter || Utils::vec_dot(e->vel,col_normal)<0)) {
+							entity_bounce(e,Utils::vec_reflect(e->vel,col_normal));
 						}
 					}
 				}
 
-				//brute-force collisions
-				for(std::size_t shape_i2=shape_i1+1;shape_i2<list_shape.size();shape_i2++) {
-					CompShape* shape2=(CompShape*)list_shape[shape_i2];
+				//shape contacts of this quad
+				const ShapeContact* c;
+				while((c=contact_next(contact_task,contact_i,shape_i1,quad_i))) {
+					CompShape* shape2=collision_shapes[c->shape2];
 					Entity* ce=shape2->entity;
 
-					if(ce==e || !shape->enabled) {
-						continue;
-					}
-
-					if( (shape->collision_group&shape2->collision_mask)==0 ||
-							(shape2->collision_group&shape->collision_mask)==0) {
-						continue;
+					//damage once per contact, keep pushing apart while the overlap lasts
+					bool enter=(shape_contacts.touch(shape,shape2)==ContactCache<CompShape*>::CONTACT_ENTER);
+					if(enter) {
+						entity_damage(e,shape2->hit_damage);
+						entity_damage(ce,shape->hit_damage);
 					}
 
-					for(const Quad& cq : shape2->quads) {
+					if(shape->bounce && shape2->bounce) {
+						sf::Vector2f b_vel=Utils::vec_normalize(e->pos-ce->pos)*100.0f;
 
-						Quad cq2=cq;
-						cq2.translate(ce->pos);
+						//sf::Vector2f tangent=Utils::vec_normalize(e->pos-ce->pos);
+						//sf::Vector2f normal(tangent.y,-tangent.x);
 
-						if(q2.intersects(cq2)) {
-							entity_damage(e,shape2->hit_damage);
-							entity_damage(ce,shape->hit_damage);
-
-							if(shape->bounce && shape2->bounce) {
-								sf::Vector2f b_vel=Utils::vec_normalize(e->pos-ce->pos)*100.0f;
-
-								//sf::Vector2f tangent=Utils::vec_normalize(e->pos-ce->pos);
-								//sf::Vector2f normal(tangent.y,-tangent.x);
-
-								CompBounce* c_bounce1=(CompBounce*)entities.component_add(e,Component::TYPE_BOUNCE);
-								c_bounce1->timer.reset(0.3);
-								c_bounce1->vel=b_vel;
-								//c_bounce1->vel=Utils::vec_reflect(e->vel,normal)*100.0f;
-
-								CompBounce* c_bounce2=(CompBounce*)entities.component_add(ce,Component::TYPE_BOUNCE);
-								c_bounce2->timer.reset(0.3);
-								c_bounce2->vel=-b_vel;
-							}
-
-							if(e==player && shape2->hit_splatter.tex) {
-								add_splatter(shape2->hit_splatter);
-							}
-							else if(ce==player && shape->hit_splatter.tex) {
-								add_splatter(shape->hit_splatter);
-							}
+						entity_bounce(e,b_vel);
+						//entity_bounce(e,Utils::vec_reflect(e->vel,normal)*100.0f);
+						entity_bounce(ce,-b_vel);
+					}
 
-						}
+					if(!enter) {
+						continue;
+					}
+					if(e==player && shape2->hit_splatter.tex) {
+						add_splatter(shape2->hit_splatter);
+					}
+					else if(ce==player && shape->hit_splatter.tex) {
+						add_splatter(shape->hit_splatter);
 					}
 				}
 			}
 		}
+		shape_contacts.end_tick();
 
 		for(Component* ccomp : entities.component_list(Component::TYPE_ENGINE)) {
 			CompEngine* comp=(CompEngine*)ccomp;
@@ -3739,7 +3971,6 @@ public:
 		}
 
 
-		const std::vector<Entity*> attractors=entities.attribute_list_entities(Entity::ATTRIBUTE_ATTRACT);
 		for(Component* ccomp : entities.component_list(Component::TYPE_AI)) {
 			CompAI* comp=(CompAI*)ccomp;
 
@@ -3750,19 +3981,11 @@ public:
 				continue;
 			}
 
-			float min_dist=0;
+			//attractors further than engage_distance are ignored anyway
 			Entity* closest_attractor=nullptr;
-
-			for(std::size_t i=0;i<attractors.size();i++) {
-				Entity* attractor=attractors[i];
-
-				if(attractor->player_side!=comp->entity->player_side) {
-					 float dist=Utils::vec_length_fast(attractor->pos-comp->entity->pos);
-					 if(!closest_attractor || dist<min_dist) {
-						 min_dist=dist;
-						 closest_attractor=attractor;
-					 }
-				}
+			if(comp->engage_distance>0.0f) {
+				entity_index.query_nearest(comp->entity->pos,comp->engage_distance+spatial_index_margin,
+						entity_group(Entity::ATTRIBUTE_ATTRACT,!comp->entity->player_side),closest_attractor);
 			}
 
 			if(closest_attractor) {
@@ -3793,26 +4016,8 @@ public:
 					e->pos=player->pos+Utils::vec_normalize(e->pos-player->pos)*wanted_dist;
 				}
 
-				const std::vector<Entity*>& targets=entities.attribute_list_entities(Entity::ATTRIBUTE_ENEMY);
-				std::vector<Entity*> targeted;
-				for(Entity * t : targets) {
-					if(Utils::vec_length_fast(e->pos-t->pos)<300*300) {
-						targeted.push_back(t);
-					}
-				}
-
 				Entity* target=nullptr;
-				if(targeted.size()>0) {
-					target=targeted[0];
-					float min_dist=Utils::vec_length_fast(targeted[0]->pos-e->pos);
-					for(std::size_t i=1;i<targeted.size();i++) {
-						float dist=Utils::vec_length_fast(targeted[i]->pos-e->pos);
-						if(dist<min_dist) {
-							min_dist=dist;
-							target=targeted[i];
-						}
-					}
-				}
+				entity_index.query_nearest(e->pos,300,entity_group(Entity::ATTRIBUTE_ENEMY),target);
 
 				if(target) {
 					e->fire_gun[0]=true;
@@ -3906,20 +4111,9 @@ public:
 				continue;
 			}
 
-			float min_dist=0;
 			Entity* closest_attractor=nullptr;
-
-			for(std::size_t i=0;i<attractors.size();i++) {
-				Entity* attractor=attractors[i];
-
-				if(attractor->player_side!=comp->entity->player_side) {
-					 float dist=Utils::vec_length_fast(attractor->pos-comp->entity->pos);
-					 if(!closest_attractor || dist<min_dist) {
-						 min_dist=dist;
-						 closest_attractor=attractor;
-					 }
-				}
-			}
+			entity_index.query_nearest(comp->entity->pos,std::numeric_limits<float>::max(),
+					entity_group(Entity::ATTRIBUTE_ATTRACT,!comp->entity->player_side),closest_attractor);
 			if(closest_attractor) {
 				float speed=150.0f;
 				float acc=200.0f;
@@ -4326,31 +4520,31 @@ public:
 			comp->node.pos=comp->entity->pos;
 		}
 
+		//gravity sources splat into a shared field, enemies sample it once
+		sf::Vector2f gravity_field_size=game_size+sf::Vector2f(1,1)*gravity_field_margin*2.0f;
+		gravity_field.reset(sf::FloatRect(player->pos-gravity_field_size*0.5f,gravity_field_size));
+
 		for(Component* ccomp : entities.component_list(Component::TYPE_GRAVITY_FORCE)) {
 			CompGravityForce* comp=(CompGravityForce*)ccomp;
 			if(!comp->enabled) {
 				continue;
 			}
 
-			float r2=comp->radius*comp->radius;
-
-			Graphic decal_graphic(Loader::get_texture("general assets/gravity_force.png"));
 			for(int i=0;i<1;i++) {
 				float angle=Utils::rand_range(0,360);
 				sf::Vector2f dir=Utils::vec_for_angle_deg(angle,1);
 				float dist=Utils::rand_range(0,comp->radius);
-				Entity* e=add_decal(decal_graphic,comp->entity->pos+dir*dist);
+				Entity* e=add_decal(graphic_gravity_force,comp->entity->pos+dir*dist);
 				entities.attribute_add(e,Entity::ATTRIBUTE_INTEGRATE_POSITION);
 				e->angle=angle;
 				e->vel=-dir*Utils::lerp(comp->power_center,comp->power_edge,dist/comp->radius);
 			}
 
+			gravity_field.splat_radial(comp->entity->pos,comp->radius,comp->power_center,comp->power_edge);
+		}
+		if(!gravity_field.is_empty()) {
 			for(Entity* e : entities.attribute_list_entities(Entity::ATTRIBUTE_ENEMY)) {
-				float dist=Utils::vec_length_fast(e->pos-comp->entity->pos);
-				if(dist<r2) {
-					e->vel=Utils::vec_normalize(comp->entity->pos-e->pos)*
-							Utils::lerp(comp->power_center,comp->power_edge,dist/r2);
-				}
+				gravity_field.sample(e->pos,e->vel);
 			}
 		}
 		for(Component* ccomp : entities.component_list(Component::TYPE_SHIELD)) {
@@ -4502,8 +4696,15 @@ public:
 					sf::Vector2f slash_p1=fighter->entity->pos+entity_rotate_vector(fighter->entity,blade1_pos+sf::Vector2f(0,-44-30));
 					sf::Vector2f slash_p2=fighter->entity->pos+entity_rotate_vector(fighter->entity,blade2_pos+sf::Vector2f(0,-44-30));
 
-					for(Component* ccomp : entities.component_list(Component::TYPE_SHAPE)) {
-						CompShape* shape=(CompShape*)ccomp;
+					Quad slash_bbox(slash_p1,slash_p2);
+					slash_bbox.sort_points();
+					slash_bbox.p1-=sf::Vector2f(1,1)*spatial_index_margin;
+					slash_bbox.p2+=sf::Vector2f(1,1)*spatial_index_margin;
+
+					shape_query.clear();
+					shape_index.query_aabb(slash_bbox,0xffffffff,shape_query);
+					for(int shape_i=0;shape_i<shape_query.size();shape_i++) {
+						CompShape* shape=shape_query[shape_i];
 						if(!shape->enabled || (shape->collision_mask&hit_mask)==0) {
 							continue;
 						}
@@ -4532,8 +4733,10 @@ public:
 					nodes[i]->rotation=angle+45;
 				}
 
-				for(Component* ccomp : entities.component_list(Component::TYPE_SHAPE)) {
-					CompShape* shape=(CompShape*)ccomp;
+				shape_query.clear();
+				shape_index.query_radius(fighter->entity->pos,100+spatial_index_margin,0xffffffff,shape_query);
+				for(int shape_i=0;shape_i<shape_query.size();shape_i++) {
+					CompShape* shape=shape_query[shape_i];
 					if(!shape->enabled || (shape->collision_mask&hit_mask)==0) {
 						continue;
 					}
@@ -4623,8 +4826,10 @@ public:
 					hit_mask=CompShape::COLLISION_GROUP_ENEMY_BULLET;
 				}
 
-				for(Component* ccomp : entities.component_list(Component::TYPE_SHAPE)) {
-					CompShape* shape=(CompShape*)ccomp;
+				shape_query.clear();
+				shape_index.query_radius(el->entity->pos,max_dist+spatial_index_margin,0xffffffff,shape_query);
+				for(int shape_i=0;shape_i<shape_query.size();shape_i++) {
+					CompShape* shape=shape_query[shape_i];
 					if(!shape->enabled || (shape->collision_mask&hit_mask)==0) {
 						continue;
 					}
@@ -4737,9 +4942,6 @@ public:
 							CompShape::COLLISION_GROUP_PLAYER);
 				}
 
-				Quad laser_bbox(laser_p1,laser_p2);
-				laser_bbox.sort_points();
-
 				Entity* hit_ship=nullptr;
 				float laser_hit_pos=1.0f;
 
@@ -4749,39 +4951,10 @@ public:
 				}
 
 				//ships
-				for(Component* ccomp : entities.component_list(Component::TYPE_SHAPE)) {
-					CompShape* shape=(CompShape*)ccomp;
-					if(!shape->enabled) {
-						continue;
-					}
-					if( (laser_collision_group&shape->collision_mask)==0 ||
-						(shape->collision_group&laser_collision_mask)==0) {
-						continue;
-					}
-
-					bool skip=false;
-					for(Quad q : shape->quads) {
-						q.translate(shape->entity->pos);
-						bool p1_inside=false;
-						float hit_pos=1.0;
-
-						if(Utils::line_quad_intersection(laser_p1,laser_p2,q,hit_pos,p1_inside)) {
-							if(p1_inside) {
-								laser_hit_pos=0.0f;
-								hit_ship=shape->entity;
-								skip=true;
-								break;
-							}
-							if(hit_pos<laser_hit_pos) {
-								laser_hit_pos=hit_pos;
-								hit_ship=shape->entity;
-							}
-						}
-
-					}
-					if(skip) {
-						break;
-					}
+				CompShape* hit_shape=shape_raycast(laser_p1,laser_p2,
+						laser_collision_group,laser_collision_mask,laser_hit_pos);
+				if(hit_shape) {
+					hit_ship=hit_shape->entity;
 				}
 
 				float laser_length=laser_range*laser_hit_pos;
@@ -4880,8 +5053,10 @@ public:
 											CompShape::COLLISION_GROUP_GRAB);
 								}
 
-								for(Component * comp : entities.component_list(Component::TYPE_SHAPE)) {
-									CompShape* shape=(CompShape*)comp;
+								shape_query.clear();
+								shape_tree.query_point(g->hook.world_pos,collision_mask,shape_query);
+								for(int shape_i=0;shape_i<shape_query.size();shape_i++) {
+									CompShape* shape=shape_query[shape_i];
 									if(!shape->enabled) continue;
 									if( /*(collision_group&shape->collision_mask)==0 ||*/
 										(shape->collision_group&collision_mask)==0) {
@@ -5004,8 +5179,10 @@ public:
 
 			float blast_range=blast->range*blast->anim/blast->duration;
 
-			for(Component* comp_shape : entities.component_list(Component::TYPE_SHAPE)) {
-				CompShape* shape=(CompShape*)comp_shape;
+			shape_query.clear();
+			shape_index.query_radius(blast->entity->pos,blast_range+spatial_index_margin,0xffffffff,shape_query);
+			for(int shape_i=0;shape_i<shape_query.size();shape_i++) {
+				CompShape* shape=shape_query[shape_i];
 				for(const Quad& quad : shape->quads) {
 					if(!quad.intersects_circle(blast->entity->pos-shape->entity->pos,blast_range)) {
 						continue;
@@ -5041,6 +5218,7 @@ public:
 		}
 
 		entities.update();
+		spatial_index_update();
 
 		for(Component* comp : entities.component_list(Component::TYPE_DISPLAY)) {
 			Entity* e=comp->entity;
@@ -5072,7 +5250,7 @@ public:
 
 
 		background.update(camera_rect);
-		terrain.update_visual(camera_rect);
+		terrain.update_visual(camera_rect,player->vel,dt);
 		minimap.update(camera_pos);
 
 		//post process
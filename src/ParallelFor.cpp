@@ -0,0 +1,89 @@
+#include "ParallelFor.h"
+
+ParallelFor::ParallelFor(int thread_count) {
+	job=nullptr;
+	job_count=0;
+	next_task=0;
+	generation=0;
+	busy_threads=0;
+	quit=false;
+
+	if(thread_count<0) {
+		thread_count=std::thread::hardware_concurrency();
+		if(thread_count>8) {
+			thread_count=8;
+		}
+	}
+	for(int i=1;i<thread_count;i++) {
+		threads.push_back(std::thread(&ParallelFor::entry,this));
+	}
+}
+ParallelFor::~ParallelFor() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit=true;
+	}
+	cond_start.notify_all();
+	for(std::thread& t : threads) {
+		t.join();
+	}
+}
+
+void ParallelFor::work() {
+	while(true) {
+		int task=next_task++;
+		if(task>=job_count) {
+			break;
+		}
+		(*job)(task);
+	}
+}
+
+void ParallelFor::entry() {
+	int seen_generation=0;
+	std::unique_lock<std::mutex> lock(mutex);
+	while(true) {
+		cond_start.wait(lock,[&]() { return quit || generation!=seen_generation; });
+		if(quit) {
+			return;
+		}
+		seen_generation=generation;
+
+		lock.unlock();
+		work();
+		lock.lock();
+
+		busy_threads--;
+		if(busy_threads==0) {
+			cond_done.notify_one();
+		}
+	}
+}
+
+void ParallelFor::run(int task_count,const std::function<void(int task)>& fn) {
+	if(task_count<=0) {
+		return;
+	}
+	if(threads.empty() || task_count==1) {
+		for(int i=0;i<task_count;i++) {
+			fn(i);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job=&fn;
+		job_count=task_count;
+		next_task=0;
+		busy_threads=threads.size();
+		generation++;
+	}
+	cond_start.notify_all();
+
+	work();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	cond_done.wait(lock,[&]() { return busy_threads==0; });
+	job=nullptr;
+}
@@ -0,0 +1,45 @@
+#ifndef _BGA_PARALLELFOR_H_
+#define _BGA_PARALLELFOR_H_
+
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+//persistent worker threads for fork-join loops
+//tasks are handed out dynamically, callers keep per-task outputs so results don't depend on thread count
+class ParallelFor {
+
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable cond_start;
+	std::condition_variable cond_done;
+
+	const std::function<void(int)>* job;
+	int job_count;
+	std::atomic<int> next_task;
+	int generation;
+	int busy_threads;
+	bool quit;
+
+	void entry();
+	void work();
+
+public:
+	//thread_count<0: one thread per hardware thread, including the caller
+	ParallelFor(int thread_count=-1);
+	~ParallelFor();
+
+	//threads working on a run, including the caller
+	int get_thread_count() const {
+		return threads.size()+1;
+	}
+
+	//calls fn(task) for every task in [0,task_count), returns when all are done
+	//not reentrant, fn must not call run()
+	void run(int task_count,const std::function<void(int task)>& fn);
+};
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef _BGA_SPATIALHASH_H_
+#define _BGA_SPATIALHASH_H_
+
+#include <stdint.h>
+#include <vector>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include <SFML/System/Vector2.hpp>
+
+#include "Quad.h"
+#include "SimpleList.h"
+
+//uniform hash grid over unbounded world space
+//cleared and refilled every tick, items spanning several cells are stored in each of them
+template<class T>
+class SpatialHash {
+
+	class Entry {
+	public:
+		Quad bbox;
+		T item;
+		uint32_t group;
+		uint32_t query_id;	//de-duplication stamp
+	};
+
+	float cell_size;
+	float cell_mult;
+	int bucket_mask;
+
+	std::vector<Entry> entries;
+	std::vector<std::vector<int> > buckets;
+	std::vector<int> used_buckets;
+	uint32_t query_id;
+
+	//cell range covered by entries, bounds the nearest search
+	int min_cx,min_cy,max_cx,max_cy;
+
+	std::vector<std::pair<float,int> > nearest;	//squared distance, entry index
+
+	int cell_coord(float x) const {
+		return (int)std::floor(x*cell_mult);
+	}
+	int bucket_index(int cx,int cy) const {
+		return (int)(((uint32_t)cx*73856093u)^((uint32_t)cy*19349663u))&bucket_mask;
+	}
+	uint32_t next_query_id() {
+		query_id++;
+		if(query_id==0) {	//wrapped, reset stamps
+			for(Entry& e : entries) {
+				e.query_id=0;
+			}
+			query_id=1;
+		}
+		return query_id;
+	}
+	void nearest_consider(int i,uint32_t id,const sf::Vector2f& pos,int k,float max_r2,uint32_t group_mask) {
+		Entry& e=entries[i];
+		if(e.query_id==id) {
+			return;
+		}
+		e.query_id=id;
+		if(!(e.group&group_mask)) {
+			return;
+		}
+		sf::Vector2f diff=(e.bbox.p1+e.bbox.p2)*0.5f-pos;
+		float d2=diff.x*diff.x+diff.y*diff.y;
+		if(d2>max_r2) {
+			return;
+		}
+		if((int)nearest.size()==k && d2>=nearest.back().first) {
+			return;
+		}
+		std::pair<float,int> n(d2,i);
+		nearest.insert(std::upper_bound(nearest.begin(),nearest.end(),n),n);
+		if((int)nearest.size()>k) {
+			nearest.pop_back();
+		}
+	}
+	//fills nearest with up to k closest entries (by bbox center), searching rings of cells outwards
+	void find_nearest(const sf::Vector2f& pos,int k,float max_radius,uint32_t group_mask) {
+		nearest.clear();
+		if(entries.empty() || k<=0) {
+			return;
+		}
+		uint32_t id=next_query_id();
+		float max_r2=max_radius*max_radius;
+
+		int cx=cell_coord(pos.x);
+		int cy=cell_coord(pos.y);
+
+		int max_ring=std::max(std::max(std::abs(cx-min_cx),std::abs(cx-max_cx)),
+				std::max(std::abs(cy-min_cy),std::abs(cy-max_cy)));
+		float radius_rings=max_radius*cell_mult+1.0f;
+		if(radius_rings<(float)max_ring) {
+			max_ring=(int)radius_rings;
+		}
+
+		for(int r=0;r<=max_ring;r++) {
+			//ring covers more cells than there are buckets, finish with a linear scan
+			if((float)(2*r+1)*(float)(2*r+1)>(float)(bucket_mask+1)) {
+				for(int i=0;i<(int)entries.size();i++) {
+					nearest_consider(i,id,pos,k,max_r2,group_mask);
+				}
+				break;
+			}
+			for(int y=cy-r;y<=cy+r;y++) {
+				int step=(y==cy-r || y==cy+r) ? 1 : 2*r;
+				for(int x=cx-r;x<=cx+r;x+=step) {
+					for(int i : buckets[bucket_index(x,y)]) {
+						nearest_consider(i,id,pos,k,max_r2,group_mask);
+					}
+				}
+			}
+			//unvisited centers lie at least r cells away
+			if((int)nearest.size()==k) {
+				float reach=(float)r*cell_size;
+				if(nearest.back().first<=reach*reach) {
+					break;
+				}
+			}
+		}
+	}
+
+	static bool bbox_intersects_circle(const Quad& q,const sf::Vector2f& pos,float r2) {
+		float dx=std::max(q.p1.x-pos.x,std::max(0.0f,pos.x-q.p2.x));
+		float dy=std::max(q.p1.y-pos.y,std::max(0.0f,pos.y-q.p2.y));
+		return (dx*dx+dy*dy<=r2);
+	}
+
+public:
+
+	SpatialHash(float _cell_size=128.0f,int bucket_count_log2=12) {
+		cell_size=_cell_size;
+		cell_mult=1.0f/cell_size;
+		bucket_mask=(1<<bucket_count_log2)-1;
+		buckets.resize(bucket_mask+1);
+		query_id=0;
+		clear();
+	}
+
+	void clear() {
+		for(int b : used_buckets) {
+			buckets[b].clear();
+		}
+		used_buckets.clear();
+		entries.clear();
+		min_cx=min_cy=0;
+		max_cx=max_cy=0;
+	}
+	int size() const {
+		return entries.size();
+	}
+
+	void insert(const Quad& bbox,const T& item,uint32_t group) {
+		int index=entries.size();
+
+		Entry e;
+		e.bbox=bbox;
+		e.item=item;
+		e.group=group;
+		e.query_id=0;
+		entries.push_back(e);
+
+		int x1=cell_coord(bbox.p1.x);
+		int y1=cell_coord(bbox.p1.y);
+		int x2=cell_coord(bbox.p2.x);
+		int y2=cell_coord(bbox.p2.y);
+
+		if(index==0) {
+			min_cx=x1;
+			min_cy=y1;
+			max_cx=x2;
+			max_cy=y2;
+		}
+		else {
+			min_cx=std::min(min_cx,x1);
+			min_cy=std::min(min_cy,y1);
+			max_cx=std::max(max_cx,x2);
+			max_cy=std::max(max_cy,y2);
+		}
+
+		for(int cy=y1;cy<=y2;cy++) {
+			for(int cx=x1;cx<=x2;cx++) {
+				int b=bucket_index(cx,cy);
+				if(buckets[b].empty()) {
+					used_buckets.push_back(b);
+				}
+				buckets[b].push_back(index);
+			}
+		}
+	}
+
+	//calls fn(entry) once for every entry stored in cells covering [p1,p2]
+	template<class F>
+	void visit(const sf::Vector2f& p1,const sf::Vector2f& p2,F fn) {
+		if(entries.empty()) {
+			return;
+		}
+		int x1=cell_coord(p1.x);
+		int y1=cell_coord(p1.y);
+		int x2=cell_coord(p2.x);
+		int y2=cell_coord(p2.y);
+
+		//huge areas cover more cells than there are buckets, scan entries directly
+		if((float)(x2-x1+1)*(float)(y2-y1+1)>(float)(bucket_mask+1)) {
+			for(Entry& e : entries) {
+				fn(e);
+			}
+			return;
+		}
+
+		uint32_t id=next_query_id();
+		for(int cy=y1;cy<=y2;cy++) {
+			for(int cx=x1;cx<=x2;cx++) {
+				for(int i : buckets[bucket_index(cx,cy)]) {
+					Entry& e=entries[i];
+					if(e.query_id==id) {
+						continue;
+					}
+					e.query_id=id;
+					fn(e);
+				}
+			}
+		}
+	}
+
+	//items whose bbox intersects quad and whose group matches group_mask, appended to out
+	void query_aabb(const Quad& quad,uint32_t group_mask,SimpleList<T>& out) {
+		visit(quad.p1,quad.p2,[&](Entry& e) {
+			if((e.group&group_mask) && e.bbox.intersects(quad)) {
+				out.push_back(e.item);
+			}
+		});
+	}
+
+	//items whose bbox intersects the circle and whose group matches group_mask, appended to out
+	void query_radius(const sf::Vector2f& pos,float radius,uint32_t group_mask,SimpleList<T>& out) {
+		float r2=radius*radius;
+		sf::Vector2f r(radius,radius);
+		visit(pos-r,pos+r,[&](Entry& e) {
+			if((e.group&group_mask) && bbox_intersects_circle(e.bbox,pos,r2)) {
+				out.push_back(e.item);
+			}
+		});
+	}
+
+	//closest item by bbox center within max_radius, false if none found
+	bool query_nearest(const sf::Vector2f& pos,float max_radius,uint32_t group_mask,T& out) {
+		find_nearest(pos,1,max_radius,group_mask);
+		if(nearest.empty()) {
+			return false;
+		}
+		out=entries[nearest[0].second].item;
+		return true;
+	}
+};
+
+#endif
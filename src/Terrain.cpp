@@ -1,68 +1,328 @@
 #include <noise/noise.h>
 #include <cmath>
 #include <algorithm>
+#include <limits>
+
+#if defined(__APPLE__)
+	#include <OpenGL/gl.h>
+#elif defined(WIN32)
+	#define NOMINMAX
+	#include <Windows.h>
+#else	//linux
+	#include <GL/gl.h>
+#endif
+
+#include <SFML/OpenGL.hpp>
 
 #include "Loader.h"
 #include "Terrain.h"
+#include "ParallelFor.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+#define BGA_TERRAIN_SSE2
+#include <emmintrin.h>
+#endif
 
 ImageDataFloat* TerrainIsland::dist_map=NULL;
 ImageDataFloat* TerrainIsland::noise_map=NULL;
 TerrainLoader* TerrainIsland::loader=NULL;
+TerrainPool* TerrainIsland::pool=NULL;
+bool TerrainIsland::compact_pixels=true;
+int TerrainIsland::pixel_channels=0;
+sf::Shader* TerrainIsland::compact_shader=NULL;
+bool TerrainIsland::gpu_raster=false;
+sf::Shader* TerrainIsland::raster_shader=NULL;
+sf::Texture* TerrainIsland::noise_texture=NULL;
 
 
+//drains the island's pending rects of one priority
 class TerrainLoaderTaskUpdateArea : public TerrainLoaderTask {
 	TerrainIsland* island;
-	sf::IntRect update_rect;
+	uint32_t generation;
 public:
-	TerrainLoaderTaskUpdateArea(TerrainIsland* _island,sf::IntRect _rect) {
+	TerrainLoaderTaskUpdateArea(TerrainIsland* _island,const sf::IntRect& rect,Priority _priority) {
 		island=_island;
-		update_rect=_rect;
+		generation=island->get_load_generation();
+		priority=_priority;
+		pos=island->box.p1+sf::Vector2f(
+				rect.left+rect.width*0.5f,
+				rect.top+rect.height*0.5f);
+	}
+	bool cancelled() {
+		return (island->get_load_generation()!=generation);
 	}
 	void execute() {
-		island->update_area(update_rect);
+		island->update_pending(priority);
 	}
 };
 class TerrainLoaderTaskInit : public TerrainLoaderTask {
+	Terrain* terrain;
 	TerrainIsland* island;
 public:
-	TerrainLoaderTaskInit(TerrainIsland* _island) {
+	TerrainLoaderTaskInit(Terrain* _terrain,TerrainIsland* _island,Priority _priority) {
+		terrain=_terrain;
 		island=_island;
+		priority=_priority;
+		pos=(island->box.p1+island->box.p2)*0.5f;
 	}
 	void execute() {
-		island->init();
+		island->generate(terrain);
 	}
 };
 
 
-float TerrainIsland::image_get_light(const ImageData& data,int px,int py,int radius) {
-	float light=1.0;
-	for(int x=px-radius;x<=px+radius;x++) {
-		if(x>0 && x<(int)data.size.x) {
-			int data_i=(py*data.size.x+x)*4;
-			if(data.data[data_i+3]!=0) continue;
+namespace {
+	//kernel radius compiled into shader/terrain_raster.frag
+	const int raster_light_radius=5;
+
+	//same texture object, storage respecified as one byte per texel, data may be NULL
+	void alpha_storage(sf::Texture* texture,const sf::Uint8* data) {
+		GLint previous_texture=0;
+		glGetIntegerv(GL_TEXTURE_BINDING_2D,&previous_texture);
+		sf::Texture::bind(texture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+		glTexImage2D(GL_TEXTURE_2D,0,GL_ALPHA8,texture->getSize().x,texture->getSize().y,0,GL_ALPHA,GL_UNSIGNED_BYTE,data);
+		glPixelStorei(GL_UNPACK_ALIGNMENT,4);
+		glBindTexture(GL_TEXTURE_2D,previous_texture);
+	}
+
+	//alpha of count pixels, coverage is left+slope*(t+i)+noise[i]>0.5
+	void raster_span(float left,float slope,int t,const float* noise,sf::Uint8* dest,int count) {
+		int i=0;
+#ifdef BGA_TERRAIN_SSE2
+		const __m128 half=_mm_set1_ps(0.5f);
+		const __m128 step=_mm_set1_ps(slope*4.0f);
+		const __m128i alpha_mask=_mm_set1_epi32(0xff000000);
+		__m128 val=_mm_add_ps(_mm_set1_ps(left),
+				_mm_mul_ps(_mm_set1_ps(slope),_mm_setr_ps(t,t+1,t+2,t+3)));
+		//16 RGBA pixels per iteration, alpha byte replaced in place
+		//no packing here, each compare mask already lines up with the 4 pixels it covers
+		for(;i+16<=count;i+=16) {
+			for(int k=0;k<4;k++) {
+				__m128 v=_mm_add_ps(val,_mm_loadu_ps(noise+i+k*4));
+				__m128i cover=_mm_and_si128(_mm_castps_si128(_mm_cmpgt_ps(v,half)),alpha_mask);
+				__m128i* p=(__m128i*)(dest+(i+k*4)*4);
+				__m128i px=_mm_andnot_si128(alpha_mask,_mm_loadu_si128(p));
+				_mm_storeu_si128(p,_mm_or_si128(px,cover));
+				val=_mm_add_ps(val,step);
+			}
+		}
+		for(;i+4<=count;i+=4) {
+			__m128 v=_mm_add_ps(val,_mm_loadu_ps(noise+i));
+			__m128i cover=_mm_and_si128(_mm_castps_si128(_mm_cmpgt_ps(v,half)),alpha_mask);
+			__m128i* p=(__m128i*)(dest+i*4);
+			__m128i px=_mm_andnot_si128(alpha_mask,_mm_loadu_si128(p));
+			_mm_storeu_si128(p,_mm_or_si128(px,cover));
+			val=_mm_add_ps(val,step);
+		}
+#endif
+		for(;i<count;i++) {
+			float v=left+slope*(t+i)+noise[i];
+			dest[i*4+3]=(v>0.5f ? 255 : 0);
+		}
+	}
+	//same for one byte pixels
+	void raster_span_compact(float left,float slope,int t,const float* noise,sf::Uint8* dest,int count) {
+		int i=0;
+#ifdef BGA_TERRAIN_SSE2
+		const __m128 half=_mm_set1_ps(0.5f);
+		const __m128 step=_mm_set1_ps(slope*4.0f);
+		__m128 val=_mm_add_ps(_mm_set1_ps(left),
+				_mm_mul_ps(_mm_set1_ps(slope),_mm_setr_ps(t,t+1,t+2,t+3)));
+		//16 pixels per iteration, compare masks packed down to bytes
+		for(;i+16<=count;i+=16) {
+			__m128i c[4];
+			for(int k=0;k<4;k++) {
+				c[k]=_mm_castps_si128(_mm_cmpgt_ps(_mm_add_ps(val,_mm_loadu_ps(noise+i+k*4)),half));
+				val=_mm_add_ps(val,step);
+			}
+			__m128i lo=_mm_packs_epi32(c[0],c[1]);
+			__m128i hi=_mm_packs_epi32(c[2],c[3]);
+			_mm_storeu_si128((__m128i*)(dest+i),_mm_packs_epi16(lo,hi));
+		}
+#endif
+		for(;i<count;i++) {
+			float v=left+slope*(t+i)+noise[i];
+			dest[i]=(v>0.5f ? 255 : 0);
+		}
+	}
+}
+
+//textures and lights pixels of [px1,px2)x[py1,py2), alpha must be rasterized
+//light=1+weight.x*(empty left-empty right)+weight.y*(empty above-empty below) within light_radius, box sums from a summed area table
+void TerrainIsland::shade_area(const TerrainPixelView& view,int px1,int py1,int px2,int py2) {
+	int rx=light_radius.x;
+	int ry=light_radius.y;
+
+	//table covers the rect grown by the radius, origin at (ex,ey)
+	int ex=px1-rx;
+	int ey=py1-ry;
+	int sw=(px2-px1)+2*rx;
+	int sh=(py2-py1)+2*ry;
+	int stride=sw+1;
+	std::vector<int> sat(stride*(sh+1),0);
+
+	int width=w*cell_size;
+	int height=h*cell_size;
+	int ch=view.channels;
+	int cov=view.coverage();
+	for(int y=0;y<sh;y++) {
+		int py=ey+y;
+		const sf::Uint8* row=(py>=0 && py<height) ? view.at(0,py) : NULL;
+		int* dest=&sat[(y+1)*stride+1];
+		const int* above=&sat[y*stride+1];
+		int row_sum=0;
+		for(int x=0;x<sw;x++) {
+			int px=ex+x;
+			bool solid=(row && px>0 && px<width && row[px*ch+cov]!=0);
+			row_sum+=!solid;
+			dest[x]=above[x]+row_sum;
+		}
+	}
+	float weight_x=light_weight.x/(float)(2*ry+1);
+	float weight_y=light_weight.y/(float)(2*rx+1);
+	float limit=light_limit;
+	float light_scale=254.0f/(2.0f*limit);
+
+	for(int y=py1;y<py2;y++) {
+		sf::Uint8* dest=view.at(px1,y);
+		const sf::Uint8* tex_row=terrain_texture.data+(y%terrain_texture.size.y)*terrain_texture.size.x*4;
+		int tex_x=px1%terrain_texture.size.x;
+
+		//table rows bounding the kernel rows [y-ry,y] and (y,y+ry]
+		const int* top=&sat[(y-ry-ey)*stride];
+		const int* mid=&sat[(y-ey+1)*stride];
+		const int* bottom=&sat[(y+ry-ey+1)*stride];
+
+		for(int x=px1;x<px2;x++,dest+=ch) {
+			if(dest[cov]!=0) {
+				float l=1.0f;
+				if(weight_x!=0) {
+					//empties in kernel rows left of column c
+					int c=x-ex;
+					int left=(bottom[c-rx]-top[c-rx]);
+					int center=(bottom[c+1]-top[c+1]);
+					int right=(bottom[c+rx+1]-top[c+rx+1]);
+					l+=weight_x*((center-left)-(right-center));
+				}
+				if(weight_y!=0) {
+					int c1=x-ex-rx;
+					int c2=x-ex+rx+1;
+					int above=(mid[c2]-top[c2])-(mid[c1]-top[c1]);
+					int below=(bottom[c2]-mid[c2])-(bottom[c1]-mid[c1]);
+					l+=weight_y*(above-below);
+				}
+				l=Utils::clamp(1.0f-limit,1.0f+limit,l);
+
+				if(ch==1) {
+					dest[0]=1+(int)((l-(1.0f-limit))*light_scale+0.5f);
+				}
+				else {
+					const sf::Uint8* tex=tex_row+tex_x*4;
+					dest[0]=Utils::clampi(0,255,(int)tex[0]*l);
+					dest[1]=Utils::clampi(0,255,(int)tex[1]*l);
+					dest[2]=Utils::clampi(0,255,(int)tex[2]*l);
+				}
+			}
+			if(++tex_x==(int)terrain_texture.size.x) {
+				tex_x=0;
+			}
 		}
-		if(x>px) light-=1;
-		else light+=1;
 	}
-	float limit=0.3;
-	if(light>1.0+limit) light=1.0+limit;
-	else if(light<1.0-limit) light=1.0-limit;
-	return light;
 }
 
 
-//rect is in cell coordinate system
+namespace {
+	int rect_area(const sf::IntRect& r) {
+		return r.width*r.height;
+	}
+	sf::IntRect rect_union(const sf::IntRect& a,const sf::IntRect& b) {
+		int x1=std::min(a.left,b.left);
+		int y1=std::min(a.top,b.top);
+		int x2=std::max(a.left+a.width,b.left+b.width);
+		int y2=std::max(a.top+a.height,b.top+b.height);
+		return sf::IntRect(x1,y1,x2-x1,y2-y1);
+	}
+	//adds r, merging with pending rects while the union doesn't cost more than both parts
+	void rect_list_merge(std::vector<sf::IntRect>& rects,sf::IntRect r) {
+		bool merged=true;
+		while(merged) {
+			merged=false;
+			for(std::size_t i=0;i<rects.size();i++) {
+				sf::IntRect u=rect_union(r,rects[i]);
+				if(rect_area(u)<=rect_area(r)+rect_area(rects[i])) {
+					r=u;
+					rects.erase(rects.begin()+i);
+					merged=true;
+					break;
+				}
+			}
+		}
+		rects.push_back(r);
+	}
+}
+
+//rect is in cell coordinate system, re-rasterized on the loader
 void TerrainIsland::update_area_cell(sf::IntRect rect) {
 
+	if(cell_texture) {
+		//gpu raster, only the texels change
+		cell_updates=(cell_updates.width>0 ? rect_union(cell_updates,rect) : rect);
+		return;
+	}
+
 	int px1=rect.left*cell_size;
 	int px2=(rect.left+rect.width)*cell_size;
 	int py1=rect.top*cell_size;
 	int py2=(rect.top+rect.height)*cell_size;
 
-	update_area(sf::IntRect(px1,py1,px2-px1,py2-py1));
+	sf::IntRect area(px1,py1,px2-px1,py2-py1);
+	if(loaded) {
+		queue_update(area,TerrainLoaderTask::PRIORITY_DAMAGE);
+	}
+	else if(cached) {
+		//replayed on restore
+		pending_mutex.lock();
+		rect_list_merge(cache_dirty,area);
+		pending_mutex.unlock();
+	}
+}
+
+//at most one loader task per priority is queued, later rects merge into its list
+void TerrainIsland::queue_update(const sf::IntRect& rect,TerrainLoaderTask::Priority priority) {
+	pending_mutex.lock();
+	rect_list_merge(pending_rects[priority],rect);
+	bool need_task=!pending_queued[priority];
+	pending_queued[priority]=true;
+	pending_mutex.unlock();
+
+	if(need_task) {
+		loader->add_task(new TerrainLoaderTaskUpdateArea(this,rect,priority));
+	}
 }
+void TerrainIsland::update_pending(TerrainLoaderTask::Priority priority) {
+	std::vector<sf::IntRect> rects;
+
+	pending_mutex.lock();
+	rects.swap(pending_rects[priority]);
+	pending_queued[priority]=false;
+	pending_mutex.unlock();
 
-//rect is in texture coordinate system
+	for(const sf::IntRect& r : rects) {
+		update_area(r);
+	}
+}
+void TerrainIsland::cancel_tasks() {
+	pending_mutex.lock();
+	load_generation++;
+	for(int i=0;i<2;i++) {
+		pending_rects[i].clear();
+		pending_queued[i]=false;
+	}
+	pending_mutex.unlock();
+}
+
+//rect is in texture coordinate system, only resident tiles are rasterized
 void TerrainIsland::update_area(sf::IntRect rect) {
 
 	if(!terrain_texture.data) {
@@ -71,161 +331,257 @@ void TerrainIsland::update_area(sf::IntRect rect) {
 
 	load_mutex.lock();
 
-	if(!loaded) {
+	//cached islands keep rasterizing work that was already running
+	if(!loaded && !cached) {
 		load_mutex.unlock();
 		return;
 	}
 
-	int px1=Utils::clampi(0,gpu_texture->getSize().x,rect.left);
-	int py1=Utils::clampi(0,gpu_texture->getSize().y,rect.top);
-	int px2=Utils::clampi(0,gpu_texture->getSize().x,rect.left+rect.width);
-	int py2=Utils::clampi(0,gpu_texture->getSize().y,rect.top+rect.height);
+	int px1=Utils::clampi(0,w*cell_size,rect.left);
+	int py1=Utils::clampi(0,h*cell_size,rect.top);
+	int px2=Utils::clampi(0,w*cell_size,rect.left+rect.width);
+	int py2=Utils::clampi(0,h*cell_size,rect.top+rect.height);
 
 	if(px1==px2 || py1==py2) {
 		load_mutex.unlock();
 		return;
 	}
 
-	for(int x=px1;x<px2;x++) {
-		for(int y=py1;y<py2;y++) {
-
-			float norm_x=(float)x/(float)cell_size;
-			float norm_y=(float)y/(float)cell_size;
-
-			int map_x=std::floor(norm_x);
-			int map_y=std::floor(norm_y);
-
-			int noise_i=(( (y+noise_offset.y)%noise_map->size.y)*noise_map->size.x+((x+noise_offset.x)%noise_map->size.x));
-			int data_i=(y*result.size.x+x)*4;
-
-			int p1=map[((map_y+0)*w+(map_x+0))].active;
-			int p2=map[((map_y+0)*w+std::min(w-1,map_x+1))].active;
-			int p3=map[(std::min(h-1,map_y+1)*w+(map_x+0))].active;
-			int p4=map[(std::min(h-1,map_y+1)*w+std::min(w-1,map_x+1))].active;
-
-			float lx=norm_x-map_x;
-			float ly=norm_y-map_y;
-
-			float val=Utils::lerp(
-					Utils::lerp(p1,p2,lx),
-					Utils::lerp(p3,p4,lx),
-					ly);
-
-			val+=noise_map->data[noise_i];
-
-			int color=(val>0.5 ?  255 : 0);
-
-			result.data[data_i+3]=color;
-		}
-	}
-	//texturing & shading
-	if(terrain_texture.size.x>0 && terrain_texture.size.y>0) {
-		for(int x=px1;x<px2;x++) {
-			for(int y=py1;y<py2;y++) {
-
-				int data_i=(y*result.size.x+x)*4;
-				/*
-				int tex_i=(
-						((y*3)%terrain_texture.size.y)*terrain_texture.size.x+
-						((x*3)%terrain_texture.size.x) )*4;
-						*/
-				int tex_i=(
-						((y)%terrain_texture.size.y)*terrain_texture.size.x+
-						((x)%terrain_texture.size.x) )*4;
-
-				if(result.data[data_i+3]==0) {
-					continue;
-				}
-
-				float l=image_get_light(result,x,y,5);
-				result.data[data_i+0]=Utils::clampi(0,255,(int)terrain_texture.data[tex_i+0]*l);
-				result.data[data_i+1]=Utils::clampi(0,255,(int)terrain_texture.data[tex_i+1]*l);
-				result.data[data_i+2]=Utils::clampi(0,255,(int)terrain_texture.data[tex_i+2]*l);
-
-				/*
-				result.data[data_i+0]=rand();
-				result.data[data_i+1]=rand();
-				result.data[data_i+2]=rand();
-				*/
-
+	int ts=load_chunks.chunk_size;
+	for(int ty=py1/ts;ty<=(py2-1)/ts;ty++) {
+		for(int tx=px1/ts;tx<=(px2-1)/ts;tx++) {
+			TerrainTile* tile=tiles[ty*load_chunks.size.x+tx];
+			if(!tile) {
+				continue;
 			}
+			int x1=std::max(px1,tx*ts);
+			int y1=std::max(py1,ty*ts);
+			int x2=std::min(px2,(tx+1)*ts);
+			int y2=std::min(py2,(ty+1)*ts);
+			update_tile(tile,tx,ty,sf::IntRect(x1,y1,x2-x1,y2-y1));
 		}
 	}
 
 	load_mutex.unlock();
+}
+//shading looks light_radius past the rect, so the rect is rasterized with that margin into scratch
+TerrainPixelView TerrainIsland::raster_scratch(int px1,int py1,int px2,int py2,int channels,std::vector<sf::Uint8>& scratch) {
+	int sx1=std::max(0,px1-light_radius.x);
+	int sy1=std::max(0,py1-light_radius.y);
+	int sx2=std::min(w*cell_size,px2+light_radius.x);
+	int sy2=std::min(h*cell_size,py2+light_radius.y);
 
-	sf::IntRect(0,0,0,0);
+	scratch.assign((sx2-sx1)*(sy2-sy1)*channels,0);
+	TerrainPixelView view(&scratch[0],sx2-sx1,sf::Vector2i(sx1,sy1),channels);
+
+	raster_area(view,sx1,sy1,sx2,sy2);
+	//texturing & shading
+	if(terrain_texture.size.x>0 && terrain_texture.size.y>0) {
+		shade_area(view,px1,py1,px2,py2);
+	}
+	return view;
+}
+void TerrainIsland::update_tile(TerrainTile* tile,int tile_x,int tile_y,const sf::IntRect& rect) {
+	int px1=rect.left;
+	int py1=rect.top;
+	int px2=rect.left+rect.width;
+	int py2=rect.top+rect.height;
+
+	int channels=tile->pixels.channels;
+	std::vector<sf::Uint8> scratch;
+	TerrainPixelView view=raster_scratch(px1,py1,px2,py2,channels,scratch);
+
+	int ts=load_chunks.chunk_size;
+	sf::Vector2i tile_origin(tile_x*ts,tile_y*ts);
+	TerrainPixelView dest(tile->pixels.data,tile->pixels.size.x,tile_origin,channels);
+	for(int y=py1;y<py2;y++) {
+		memcpy(dest.at(px1,y),view.at(px1,y),(px2-px1)*channels);
+	}
 
 	texture_mutex.lock();
-	texture_updates.push_back(sf::IntRect(px1,py1,px2-px1,py2-py1));
+	rect_list_merge(tile->texture_updates,sf::IntRect(px1-tile_origin.x,py1-tile_origin.y,px2-px1,py2-py1));
 	texture_mutex.unlock();
 }
-void TerrainIsland::update_texture(const sf::IntRect& rect) {
+bool TerrainIsland::raster_reference(const sf::IntRect& rect,ImageData& out) {
+	if(!generated) return false;
 
-	/*
-	for(int x=0;x<result.data_size;x++) {
-		result.data[x]=rand();
-	}
-	*/
-	//texture=NULL;//Loader::get_texture("background/a_1.png");
+	int px1=Utils::clampi(0,w*cell_size,rect.left);
+	int py1=Utils::clampi(0,h*cell_size,rect.top);
+	int px2=Utils::clampi(0,w*cell_size,rect.left+rect.width);
+	int py2=Utils::clampi(0,h*cell_size,rect.top+rect.height);
+	if(px1==px2 || py1==py2) return false;
 
-	if(rect.width==(int)result.size.x) {
-		gpu_texture->update(result.data+rect.top*result.size.x*4,result.size.x,rect.height,0,rect.top);
+	out.create(px2-px1,py2-py1,4);
+	std::vector<sf::Uint8> scratch;
+	load_mutex.lock();
+	TerrainPixelView view=raster_scratch(px1,py1,px2,py2,4,scratch);
+	load_mutex.unlock();
+	TerrainPixelView dest(out.data,out.size.x,sf::Vector2i(px1,py1),4);
+	for(int y=py1;y<py2;y++) {
+		memcpy(dest.at(px1,y),view.at(px1,y),(px2-px1)*4);
 	}
-	//update delta only
-	else {
-
-		//printf("update %d %d %d %d texture %d %d\n",px1,py1,px2,py2,gpu_texture->getSize().x,gpu_texture->getSize().y);
-		sf::Uint8* src=result.data+((rect.top*result.size.x)+rect.left)*4;
-		sf::Uint8* dest=result_temp.data;
-
-		int src_stride=result.size.x*4;
-		int dest_stride=(rect.width)*4;
-
-		int lines=rect.height;
-
-		for(int i=0;i<lines;i++) {
-			memcpy(dest,src,dest_stride);
-			src+=src_stride;
-			dest+=dest_stride;
+	return true;
+}
+void TerrainIsland::raster_area(const TerrainPixelView& view,int px1,int py1,int px2,int py2) {
+	int span=px2-px1;
+	if((int)noise_row.size()<span) {
+		noise_row.resize(span);
+	}
+	float cell_mult=1.0f/(float)cell_size;
+
+	for(int y=py1;y<py2;y++) {
+		sf::Uint8* dest=view.at(px1,y);
+
+		//noise row copied out in wrapped pieces
+		const float* noise_src=noise_map->data+((y+noise_offset.y)%noise_map->size.y)*noise_map->size.x;
+		int noise_x=(px1+noise_offset.x)%noise_map->size.x;
+		for(int i=0;i<span;) {
+			int n=std::min(span-i,(int)noise_map->size.x-noise_x);
+			memcpy(&noise_row[i],noise_src+noise_x,n*sizeof(float));
+			i+=n;
+			noise_x=0;
 		}
 
-		//printf("partial update %d %d %d %d\n",rect.left,rect.top,rect.width,rect.height);
-		gpu_texture->update(result_temp.data,rect.width,rect.height,rect.left,rect.top);
+		int map_y=y/cell_size;
+		int map_y2=std::min(h-1,map_y+1);
+		float ly=(float)(y-map_y*cell_size)*cell_mult;
+
+		//cell spans, corners are constant and the bilinear value is linear in x
+		for(int x=px1;x<px2;) {
+			int map_x=x/cell_size;
+			int map_x2=std::min(w-1,map_x+1);
+			int x_end=std::min(px2,(map_x+1)*cell_size);
+
+			float p1=cells.get(map_x,map_y);
+			float p2=cells.get(map_x2,map_y);
+			float p3=cells.get(map_x,map_y2);
+			float p4=cells.get(map_x2,map_y2);
+
+			float left=Utils::lerp(p1,p3,ly);
+			float slope=(Utils::lerp(p2,p4,ly)-left)*cell_mult;
+			if(view.channels==1) {
+				raster_span_compact(left,slope,x-map_x*cell_size,&noise_row[x-px1],dest+(x-px1),x_end-x);
+			}
+			else {
+				raster_span(left,slope,x-map_x*cell_size,&noise_row[x-px1],dest+(x-px1)*4,x_end-x);
+			}
+			x=x_end;
+		}
+	}
+}
+//uploads straight from the tile pixels, GL reads them with the full row stride
+void TerrainIsland::update_texture(TerrainTile* tile,const sf::IntRect& rect) {
+	GLint previous_texture=0;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D,&previous_texture);
+
+	const ImageData& pixels=tile->pixels;
+	bool compact=(pixels.channels==1);
+	sf::Texture::bind(tile->texture);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH,pixels.size.x);
+	if(compact) {
+		glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	}
+	glTexSubImage2D(GL_TEXTURE_2D,0,rect.left,rect.top,rect.width,rect.height,
+			compact ? GL_ALPHA : GL_RGBA,GL_UNSIGNED_BYTE,
+			pixels.data+((rect.top*pixels.size.x)+rect.left)*pixels.channels);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH,0);
+	if(compact) {
+		glPixelStorei(GL_UNPACK_ALIGNMENT,4);
 	}
 
-
-	/*
-	if(px2-px1==result.size.x) {
-		//printf("full update\n");
-		gpu_texture->update(result.data+py1*result.size.x*4,px2-px1,py2-py1,px1,py1);
+	glBindTexture(GL_TEXTURE_2D,previous_texture);
+}
+void TerrainIsland::tile_alloc(int index) {
+	int ts=load_chunks.chunk_size;
+	int tx=index%load_chunks.size.x;
+	int ty=index/load_chunks.size.x;
+
+	TerrainTile* tile=new TerrainTile();
+	pool->get_pixels(ts,ts,tile->pixels,pixel_channels);
+	tile->texture=pool->get_texture(ts,ts,pixel_channels);
+	if(pixel_channels==1) {
+		tile->node.shader.shader=compact_shader;
+		tile->node.shader.set_param("tile_origin",sf::Vector2f(tx*ts,ty*ts));
 	}
-	//update delta only
-	else {
 
-		//printf("update %d %d %d %d texture %d %d\n",px1,py1,px2,py2,gpu_texture->getSize().x,gpu_texture->getSize().y);
-		sf::Uint8* src=result.data+((py1*result.size.x)+px1)*4;
-		sf::Uint8* dest=result_temp.data;
+	//edge tiles only show the part inside the island
+	tile->node.texture=Texture(tile->texture);
+	tile->node.texture.rect=sf::IntRect(0,0,
+			std::min(ts,w*cell_size-tx*ts),
+			std::min(ts,h*cell_size-ty*ts));
+	tile->node.pos=sf::Vector2f(tx*ts,ty*ts);
+	tile->node.visible=false;	//recycled texture holds old pixels until the first upload
+	add_child(&tile->node);
 
-		int src_stride=result.size.x*4;
-		int dest_stride=(px2-px1)*4;
+	load_mutex.lock();
+	tiles[index]=tile;
+	load_chunks.chunks[index]=true;
+	load_mutex.unlock();
 
-		int lines=py2-py1;
+	queue_update(sf::IntRect(tx*ts,ty*ts,ts,ts),TerrainLoaderTask::PRIORITY_VISIBLE);
+}
+void TerrainIsland::tile_free(int index) {
+	load_mutex.lock();
+	TerrainTile* tile=tiles[index];
+	tiles[index]=NULL;
+	load_chunks.chunks[index]=false;
+	load_mutex.unlock();
 
-		for(int i=0;i<lines;i++) {
-			memcpy(dest,src,dest_stride);
-			src+=src_stride;
-			dest+=dest_stride;
+	remove_child(&tile->node);
+	pool->put_texture(tile->texture,tile->pixels.channels);
+	pool->put_pixels(tile->pixels);
+	delete(tile);
+}
+//cells of rect as texels, 255 where active
+void TerrainIsland::update_cell_texture(const sf::IntRect& rect) {
+	std::vector<sf::Uint8> texels(rect.width*rect.height);
+	for(int y=0;y<rect.height;y++) {
+		for(int x=0;x<rect.width;x++) {
+			texels[y*rect.width+x]=(cells.get(rect.left+x,rect.top+y) ? 255 : 0);
 		}
-		gpu_texture->update(result_temp.data,px2-px1,py2-py1,px1,py1);
 	}
-	*/
+
+	GLint previous_texture=0;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D,&previous_texture);
+
+	sf::Texture::bind(cell_texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	glTexSubImage2D(GL_TEXTURE_2D,0,rect.left,rect.top,rect.width,rect.height,
+			GL_ALPHA,GL_UNSIGNED_BYTE,&texels[0]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT,4);
+
+	glBindTexture(GL_TEXTURE_2D,previous_texture);
+}
+//one quad over the whole island, scaled up from the cell map
+void TerrainIsland::cell_texture_alloc() {
+	cell_texture=new sf::Texture();
+	cell_texture->create(w,h);
+	cell_texture->setSmooth(false);
+	alpha_storage(cell_texture,NULL);
+	update_cell_texture(sf::IntRect(0,0,w,h));
+	cell_updates=sf::IntRect();
+
+	cell_node.texture=Texture(cell_texture);
+	cell_node.scale=sf::Vector2f(cell_size,cell_size);
+	cell_node.shader.shader=raster_shader;
+	cell_node.shader.set_param("cell_count",sf::Vector2f(w,h));
+	cell_node.shader.set_param("noise_offset",sf::Vector2f(noise_offset.x,noise_offset.y));
+	add_child(&cell_node);
+}
+void TerrainIsland::cell_texture_free() {
+	remove_child(&cell_node);
+	cell_node.texture=Texture();
+	delete(cell_texture);
+	cell_texture=NULL;
+	cell_updates=sf::IntRect();
 }
 
 
-TerrainIsland::TerrainIsland(Quad _box) {
+TerrainIsland::TerrainIsland(Quad _box,uint32_t _seed) {
 
 	box=_box;
+	seed=_seed;
+	index=-1;
 	box_size=box.size();
 	//render_state.transform.translate(box.start);
 	terrain_texture.from_sfimage(Loader::get_image("terrain/texture.png"));
@@ -234,15 +590,22 @@ TerrainIsland::TerrainIsland(Quad _box) {
 
 	terrain_health=5;
 
+	light_radius=sf::Vector2i(5,0);
+	light_weight=sf::Vector2f(1,0);
+	light_limit=0.3;
+
 	if(!loader) {
 		loader=new TerrainLoader();
 	}
+	if(!pool) {
+		pool=new TerrainPool();
+	}
 
 	if(!noise_map) {
 		noise::module::Perlin texture_perlin;
 		texture_perlin.SetFrequency(0.05*20);
 		texture_perlin.SetOctaveCount(2);
-		texture_perlin.SetSeed(rand());
+		texture_perlin.SetSeed(Utils::hash32(seed,0));
 
 		noise::model::Sphere sphere(texture_perlin);
 
@@ -288,13 +651,22 @@ TerrainIsland::TerrainIsland(Quad _box) {
 	load_chunk_size=256;
 
 	noise_offset=sf::Vector2i(
-			rand()%noise_map->size.x,
-			rand()%noise_map->size.y);
+			Utils::hash32(seed,1)%noise_map->size.x,
+			Utils::hash32(seed,2)%noise_map->size.y);
 
-	gpu_texture=NULL;
+	type=Node::TYPE_NO_RENDER;	//tiles draw as children
 
 	loaded=false;
-	map=NULL;
+	cached=false;
+	generated=false;
+	generate_queued=false;
+	cache_age=0;
+	health=NULL;
+	unload_timer=0;
+	cell_texture=NULL;
+
+	load_generation=0;
+	pending_queued[0]=pending_queued[1]=false;
 
 
 	/*
@@ -305,9 +677,10 @@ TerrainIsland::TerrainIsland(Quad _box) {
 	add_child(foo);
 	*/
 }
-void TerrainIsland::update_visual(const sf::FloatRect& rect) {
+//rect is the prefetch area, loading and unloading is up to Terrain
+void TerrainIsland::update_visual(const sf::FloatRect& rect,const sf::FloatRect& keep_rect,int& upload_budget) {
 
-	if(!map) return;
+	if(!generated) return;
 
 	/*
 	sf::FloatRect world_rect=rect;
@@ -323,22 +696,58 @@ void TerrainIsland::update_visual(const sf::FloatRect& rect) {
 	bool intersecting=box.intersects(cam_bb);
 
 	if(!loaded) {
-		if(!intersecting) {
-			return;
-		}
 		load();
 	}
-	if(!intersecting) {
-		unload();
+
+	if(cell_texture) {
+		if(cell_updates.width>0) {
+			update_cell_texture(cell_updates);
+			upload_budget-=cell_updates.width*cell_updates.height;
+			cell_updates=sf::IntRect();
+		}
+		visible=true;
 		return;
 	}
 
+	//tiles that drifted out of the keep area
+	int ts=load_chunks.chunk_size;
+	for(int i=0;i<(int)tiles.size();i++) {
+		if(!tiles[i]) {
+			continue;
+		}
+		sf::FloatRect tile_rect((i%load_chunks.size.x)*ts,(i/load_chunks.size.x)*ts,ts,ts);
+		if(!tile_rect.intersects(keep_rect)) {
+			tile_free(i);
+		}
+	}
 
+	//uploads rows while the frame budget lasts, leftovers stay queued
 	texture_mutex.lock();
-	for(const sf::IntRect& r : texture_updates) {
-		update_texture(r);
+	for(int i=0;i<(int)tiles.size() && upload_budget>0;i++) {
+		TerrainTile* tile=tiles[i];
+		if(!tile) {
+			continue;
+		}
+		while(!tile->texture_updates.empty() && upload_budget>0) {
+			sf::IntRect& r=tile->texture_updates.back();
+			int row_bytes=r.width*tile->pixels.channels;
+			int rows=std::min(r.height,std::max(1,upload_budget/row_bytes));
+
+			update_texture(tile,sf::IntRect(r.left,r.top,r.width,rows));
+			upload_budget-=rows*row_bytes;
+
+			if(rows==r.height) {
+				tile->texture_updates.pop_back();
+			}
+			else {
+				r.top+=rows;
+				r.height-=rows;
+			}
+		}
+		if(tile->texture_updates.empty()) {
+			tile->node.visible=true;
+		}
 	}
-	texture_updates.clear();
 	texture_mutex.unlock();
 	visible=true;
 
@@ -352,6 +761,10 @@ void TerrainIsland::update_visual(const sf::FloatRect& rect) {
 	*/
 	rect2=rect;
 
+	//kept around for the unload grace period
+	if(!intersecting) {
+		return;
+	}
 
 	IntBoundingBox chunk_rect=load_chunks.intersect(rect2);
 
@@ -369,34 +782,93 @@ void TerrainIsland::update_visual(const sf::FloatRect& rect) {
 			//visible
 			if(!load_chunks.chunks[i]) {
 				//printf("load chunk %d %d\n",x,y);
-				load_chunks.chunks[i]=true;
-
-				sf::IntRect update_rect(
-					x*load_chunks.chunk_size-5,
-					y*load_chunks.chunk_size-5,
-					load_chunks.chunk_size+10,
-					load_chunks.chunk_size+10);
-
-				/*
-				update_area(update_rect);
-				*/
-				loader->add_task(new TerrainLoaderTaskUpdateArea(this,update_rect));
+				tile_alloc(i);
 			}
 		}
 	}
 }
+//24 bits keep the threshold exact, 0.5 is 0x800000
+sf::Vector2u TerrainIsland::noise_texels(std::vector<sf::Uint8>& out) {
+	int count=noise_map->size.x*noise_map->size.y;
+	out.resize(count*4);
+	for(int i=0;i<count;i++) {
+		int v=Utils::clampi(0,0xffffff,std::floor((noise_map->data[i]+0.5f)*16777216.0f+0.5f));
+		out[i*4]=v>>16;
+		out[i*4+1]=(v>>8)&0xff;
+		out[i*4+2]=v&0xff;
+		out[i*4+3]=255;
+	}
+	return noise_map->size;
+}
+//picks the tile format on the first load, with a GL context around
+void TerrainIsland::init_pixel_format() {
+	pixel_channels=4;
+	if((!compact_pixels && !gpu_raster) || !sf::Shader::isAvailable()) {
+		return;
+	}
+	Texture material=Loader::get_texture("terrain/texture.png");
+	if(!material.tex) {
+		printf("terrain material unavailable, using RGBA tiles\n");
+		return;
+	}
+	material.tex->setRepeated(true);
+
+	//the shader kernel is horizontal with a fixed radius
+	if(gpu_raster && light_radius==sf::Vector2i(raster_light_radius,0)) {
+		raster_shader=Loader::get_shader("shader/terrain_raster.frag");
+		if(raster_shader) {
+			std::vector<sf::Uint8> noise;
+			noise_texels(noise);
+			noise_texture=new sf::Texture();
+			noise_texture->create(noise_map->size.x,noise_map->size.y);
+			noise_texture->setSmooth(false);
+			noise_texture->setRepeated(true);
+			noise_texture->update(&noise[0]);
+
+			raster_shader->setParameter("noise",*noise_texture);
+			raster_shader->setParameter("noise_size",Utils::vec_to_f(noise_map->size));
+			raster_shader->setParameter("material",*material.tex);
+			raster_shader->setParameter("material_size",material.get_size());
+			raster_shader->setParameter("cell_size",(float)cell_size);
+			raster_shader->setParameter("light_weight",light_weight.x);
+			raster_shader->setParameter("light_limit",light_limit);
+			return;
+		}
+		printf("terrain raster shader unavailable, using tiles\n");
+	}
+	if(!compact_pixels) {
+		return;
+	}
+	compact_shader=Loader::get_shader("shader/terrain.frag");
+	if(!compact_shader) {
+		printf("compact terrain unavailable, using RGBA tiles\n");
+		return;
+	}
+	compact_shader->setParameter("material",*material.tex);
+	compact_shader->setParameter("material_size",material.get_size());
+	compact_shader->setParameter("tile_size",sf::Vector2f(load_chunk_size,load_chunk_size));
+	compact_shader->setParameter("light_limit",light_limit);
+	pixel_channels=1;
+}
 void TerrainIsland::init() {
-	map=new TerrainIslandPoint[w*h];
+	BitGrid grid;
+	grid.create(w,h);
+	generate_cells(grid);
 
+	//main thread may be reading the island, it only trusts the cells once generated is set
+	load_mutex.lock();
+	cells.swap(grid);
+	load_mutex.unlock();
+	version_id++;
+}
+void TerrainIsland::generate_cells(BitGrid& grid) const {
 	noise::module::Perlin perlin;
 	perlin.SetFrequency(0.2);
 	perlin.SetOctaveCount(2);
-	perlin.SetSeed(rand());
+	perlin.SetSeed(seed);
 
 	for(int x=0;x<w;x++) {
 		for(int y=0;y<h;y++) {
-			int i=y*w+x;
-
 			float noise=perlin.GetValue(x,y,0);
 			noise=noise*0.5+1;
 			noise*=dist_map->lookup(
@@ -404,34 +876,87 @@ void TerrainIsland::init() {
 					(float)y/(float)(h-1)
 					);
 
-			if(noise<0.5) {
-				map[i].active=false;
-			}
-			else {
-				map[i].active=true;
-				map[i].health=terrain_health;
-
-				//float d=cell_size/2;
-				//map[i].pos.x=x*cell_size+Utils::rand_range(-d,d);
-				//map[i].pos.y=y*cell_size+Utils::rand_range(-d,d);
-				//map[i].size=Utils::rand_range(cell_size*0.5,cell_size*0.75);
+			if(noise>=0.5) {
+				grid.set(x,y,true);
 			}
 		}
 	}
-	version_id++;
+}
+//generates the cell map once, from any thread
+void TerrainIsland::generate(Terrain* terrain) {
+	if(generated) {
+		return;
+	}
+	generate_mutex.lock();
+	if(!generated) {
+		init();
+		terrain->occupancy_add(this);
+		generated=true;
+	}
+	generate_mutex.unlock();
+}
+bool TerrainIsland::attach_cells(int _w,int _h,uint64_t* words) {
+	if(_w!=w || _h!=h) {
+		return false;
+	}
+	bool attached=false;
+	generate_mutex.lock();
+	if(!generated) {
+		cells.attach(w,h,words);
+		version_id++;
+		generated=true;
+		attached=true;
+	}
+	generate_mutex.unlock();
+	return attached;
+}
+float& TerrainIsland::cell_health(int index) {
+	if(!health) {
+		health=new float[w*h];
+		for(int i=0;i<w*h;i++) {
+			health[i]=terrain_health;
+		}
+	}
+	return health[index];
 }
 void TerrainIsland::load() {
-	if(!map || loaded) return;
+	if(!generated || loaded) return;
+
+	//restore from cache, pixels are intact apart from damage since unload
+	if(cached) {
+		std::vector<sf::IntRect> dirty;
+
+		pending_mutex.lock();
+		dirty.swap(cache_dirty);
+		pending_mutex.unlock();
+
+		load_mutex.lock();
+		cached=false;
+		loaded=true;
+		load_mutex.unlock();
+
+		for(const sf::IntRect& r : dirty) {
+			queue_update(r,TerrainLoaderTask::PRIORITY_DAMAGE);
+		}
+		visible=false;
+		return;
+	}
 
 	//printf("Load terrain\n");
 
-	result.create(w*cell_size,h*cell_size);
-	result_temp.create(w*cell_size,h*cell_size);
+	if(!pixel_channels) {
+		init_pixel_format();
+	}
 
-	gpu_texture=new sf::Texture();
-	gpu_texture->create(result.size.x,result.size.y);
-	gpu_texture->setSmooth(false);
-	//gpu_texture->
+	if(raster_shader) {
+		cell_texture_alloc();
+		visible=false;
+		loaded=true;
+		return;
+	}
+
+	int pixel_w=w*cell_size;
+	int pixel_h=h*cell_size;
 
 	//texture=Loader::get_texture("terrain/texture.png");
 	//type=Node::TYPE_SOLID;
@@ -451,10 +976,10 @@ void TerrainIsland::load() {
 				box.getSize().y/3),
 			load_chunk_size);
 			*/
-	load_chunks.for_size(box_size,load_chunk_size);
+	//tiles are allocated as they come into view
+	load_chunks.for_size(sf::Vector2f(pixel_w,pixel_h),load_chunk_size);
 	load_chunks.set_all(false);
-
-	texture_updates.clear();
+	tiles.assign(load_chunks.size.x*load_chunks.size.y,NULL);
 
 	/*
 	printf("Terrain size %d %d, chunks size %d %d (%dx chunk)\n",
@@ -463,55 +988,109 @@ void TerrainIsland::load() {
 			load_chunks.chunk_size);
 	*/
 
-	texture=Texture(gpu_texture);
-
 	visible=false;
 	loaded=true;
 }
+//keeps resident tiles around, evict() frees them
 void TerrainIsland::unload() {
-	if(!map || !loaded) return;
+	if(!generated || !loaded) return;
 
 	//printf("Unload terrain\n");
 
+	//queued rasterization is replayed on restore
+	pending_mutex.lock();
+	load_generation++;
+	for(int i=0;i<2;i++) {
+		for(const sf::IntRect& r : pending_rects[i]) {
+			rect_list_merge(cache_dirty,r);
+		}
+		pending_rects[i].clear();
+		pending_queued[i]=false;
+	}
+	pending_mutex.unlock();
+
 	load_mutex.lock();
+	loaded=false;
+	cached=true;
+	visible=false;
+	cache_age=0;
+	load_mutex.unlock();
+}
+void TerrainIsland::evict() {
+	if(!cached) return;
+
+	cancel_tasks();
+
+	if(cell_texture) {
+		cell_texture_free();
+	}
+	for(int i=0;i<(int)tiles.size();i++) {
+		if(tiles[i]) {
+			tile_free(i);
+		}
+	}
 
-	delete(gpu_texture);
-	gpu_texture=NULL;
+	load_mutex.lock();
 
-	result.unload();
-	result_temp.unload();
+	tiles.clear();
 	load_chunks.unload();
+	std::vector<float>().swap(noise_row);
 
-	loaded=false;
-	visible=false;
+	cached=false;
+	cache_dirty.clear();
 
 	load_mutex.unlock();
 }
+std::size_t TerrainIsland::get_resident_bytes() const {
+	std::size_t bytes=(cell_texture ? w*h : 0);
+	for(const TerrainTile* tile : tiles) {
+		if(tile) {
+			bytes+=tile->pixels.data_size+tile->texture->getSize().x*tile->texture->getSize().y*tile->pixels.channels;
+		}
+	}
+	return bytes;
+}
 
 
-void TerrainIsland::damage_area(const sf::FloatRect& rect,float damage) {
-	if(!map) return;
-
+sf::IntRect TerrainIsland::get_cell_range(const sf::FloatRect& rect) const {
 	//float mult=1.0f/(cell_size*3.0);
 	float mult=1.0f/(cell_size);
 	int x1=Utils::clampi(0,w,std::floor( rect.left *mult+0.5f ));
 	int y1=Utils::clampi(0,h,std::floor( rect.top  *mult+0.5f ));
 	int x2=Utils::clampi(0,w,std::ceil( (rect.left+rect.width) *mult+0.5f ));
 	int y2=Utils::clampi(0,h,std::ceil( (rect.top+rect.height) *mult+0.5f ));
+	return sf::IntRect(x1,y1,x2-x1,y2-y1);
+}
+bool TerrainIsland::damage_area(const sf::FloatRect& rect,float damage) {
+	if(!generated) return false;
+	return damage_cells(get_cell_range(rect),damage);
+}
+bool TerrainIsland::damage_chunk(int index,float damage) {
+	if(!generated || index<0 || index>=w*h) {
+		return false;
+	}
+	return damage_cells(sf::IntRect(index%w,index/w,1,1),damage);
+}
+bool TerrainIsland::damage_cells(const sf::IntRect& range,float damage) {
+	if(!generated) return false;
 
-	//for(int i=0;i<w*h;i++) map[i].active=false;
+	int x1=std::max(0,range.left);
+	int y1=std::max(0,range.top);
+	int x2=std::min(w,range.left+range.width);
+	int y2=std::min(h,range.top+range.height);
+	if(x1>=x2 || y1>=y2) return false;
 
 	bool need_update=false;
 
 	load_mutex.lock();
 
-	for(int x=x1;x<x2;x++) {
-		for(int y=y1;y<y2;y++) {
-			int map_i=y*w+x;
-			if(!map[map_i].active) continue;
-			map[map_i].health-=damage;
-			if(map[map_i].health<=0) {
-				map[map_i].active=false;
+	for(int y=y1;y<y2;y++) {
+		for(int x=x1;x<x2;x++) {
+			if(!cells.get(x,y)) continue;
+			float& cell=cell_health(y*w+x);
+			cell-=damage;
+			if(cell<=0) {
+				cells.set(x,y,false);
 				need_update=true;
 			}
 		}
@@ -521,45 +1100,62 @@ void TerrainIsland::damage_area(const sf::FloatRect& rect,float damage) {
 
 	version_id++;
 
-	if(!loaded || !need_update) {
-		return;
+	if(!need_update) {
+		return false;
 	}
 
-	update_area_cell(sf::IntRect(
-			std::max(0,x1-1),
-			std::max(0,y1-1),
-			std::min(w,x2-x1+1),
-			std::min(h,y2-y1+1)
-		));
+	//pixels of neighbor cells blend into destroyed ones
+	int ux1=std::max(0,x1-1);
+	int uy1=std::max(0,y1-1);
+	int ux2=std::min(w,x2+1);
+	int uy2=std::min(h,y2+1);
+	update_area_cell(sf::IntRect(ux1,uy1,ux2-ux1,uy2-uy1));
+	return true;
 }
-void TerrainIsland::damage_chunk(int index,float damage) {
-	if(index<0 || index>=w*h) {
-		return;
+void TerrainIsland::get_state(TerrainJournal::IslandState& out) const {
+	out.island=index;
+	out.cells.assign(cells.words,cells.words+cells.stride*cells.h);
+	if(health) {
+		out.health.assign(health,health+w*h);
 	}
-	if(!map[index].active) {
-		return;
+	else {
+		out.health.clear();
 	}
-
-	map[index].health-=damage;
-	if(map[index].health>0) {
-		return;
+}
+void TerrainIsland::set_state(const TerrainJournal::IslandState* state) {
+	BitGrid grid;
+	grid.create(w,h);
+	if(state && (int)state->cells.size()==grid.stride*grid.h) {
+		memcpy(grid.words,&state->cells[0],state->cells.size()*sizeof(uint64_t));
+	}
+	else {
+		generate_cells(grid);
 	}
 
-	map[index].active=false;
-	int x=index%w;
-	int y=index/w;
-	update_area_cell(sf::IntRect(
-			std::max(0,x-1),
-			std::max(0,y-1),
-			std::min(w,x+1),
-			std::min(h,y+1)
-		));
+	load_mutex.lock();
+	cells.swap(grid);
+	if(state && (int)state->health.size()==w*h) {
+		cell_health(0);
+		memcpy(health,&state->health[0],w*h*sizeof(float));
+	}
+	else {
+		delete[] health;
+		health=NULL;
+	}
+	load_mutex.unlock();
 
+	version_id++;
+	update_area_cell(sf::IntRect(0,0,w,h));
+}
+sf::Vector2f TerrainIsland::get_chunk_pos(int index) const {
+	return box.p1+sf::Vector2f(index%w,index/w)*(float)cell_size;
 }
 
 bool TerrainIsland::check_collision(const sf::FloatRect& rect) {
-	if(!map) return false;
-
+	if(!generated) return false;
+	return check_cells(rect);
+}
+bool TerrainIsland::check_cells(const sf::FloatRect& rect) {
 	//float mult=1.0f/(cell_size*3.0);
 	float mult=1.0f/(cell_size);
 	int x1=Utils::clampi(0,w,std::floor( rect.left *mult+0.5f ));
@@ -567,16 +1163,10 @@ bool TerrainIsland::check_collision(const sf::FloatRect& rect) {
 	int x2=Utils::clampi(0,w,std::ceil( (rect.left+rect.width) *mult+0.5f ));
 	int y2=Utils::clampi(0,h,std::ceil( (rect.top+rect.height) *mult+0.5f ));
 
-	for(int x=x1;x<x2;x++) {
-		for(int y=y1;y<y2;y++) {
-			int map_i=y*w+x;
-			if(map[map_i].active) return true;
-		}
-	}
-	return false;
+	return cells.any(x1,y1,x2,y2);
 }
 bool TerrainIsland::check_collision(const sf::FloatRect& rect,sf::Vector2f& normal) {
-	if(!map) return false;
+	if(!generated) return false;
 
 	//float mult=1.0f/(cell_size*3.0);
 	float mult=1.0f/(cell_size);
@@ -588,28 +1178,23 @@ bool TerrainIsland::check_collision(const sf::FloatRect& rect,sf::Vector2f& norm
 	sf::Vector2f rect_p=sf::Vector2f(rect.left,rect.top)+sf::Vector2f(rect.width,rect.height)*0.5f;
 	rect_p=rect_p*mult;
 
-	bool collision=false;
-
 	normal.x=normal.y=0.0f;
 
-	for(int x=x1;x<x2;x++) {
-		for(int y=y1;y<y2;y++) {
-			int map_i=y*w+x;
-			if(map[map_i].active) {
-				collision=true;
-				normal+=(rect_p-sf::Vector2f(x,y));
-			}
-		}
-	}
-
-	if(collision) {
-		normal=Utils::vec_normalize(normal);
+	//sum of (rect_p-cell) over active cells
+	sf::Vector2f cell_sum;
+	int count=cells.sum(x1,y1,x2,y2,cell_sum);
+	if(count==0) {
+		return false;
 	}
-	return collision;
+	normal=rect_p*(float)count-cell_sum;
+	normal=Utils::vec_normalize(normal);
+	return true;
 }
 bool TerrainIsland::check_collision(const sf::Vector2f& pos,ChunkAddress& chunk) {
-	if(!map) return false;
-
+	if(!generated) return false;
+	return check_cells(pos,chunk);
+}
+bool TerrainIsland::check_cells(const sf::Vector2f& pos,ChunkAddress& chunk) {
 	//float mult=1.0f/(cell_size*3.0f);
 	float mult=1.0f/(cell_size);
 
@@ -617,13 +1202,8 @@ bool TerrainIsland::check_collision(const sf::Vector2f& pos,ChunkAddress& chunk)
 	int y=std::floor(pos.y*mult+0.5f);
 
 	if(x<0 || y<0 || x>=w || y>=h) return false;
-	/*
-	if(map[y*w+x].active) {
-		damage_area(sf::FloatRect(pos,sf::Vector2f(10,10)),100);
-	}
-	*/
 
-	if(!map[y*w+x].active) {
+	if(!cells.get(x,y)) {
 		return false;
 	}
 
@@ -631,8 +1211,58 @@ bool TerrainIsland::check_collision(const sf::Vector2f& pos,ChunkAddress& chunk)
 	chunk.chunk_index=y*w+x;
 	return true;
 }
+//cell DDA, cell x covers [x-0.5,x+0.5)*cell_size
+bool TerrainIsland::query_ray(const sf::Vector2f& p1,const sf::Vector2f& p2,float t_min,float t_max,
+		float& out_t,ChunkAddress& chunk) {
+	if(!generated) return false;
+
+	float mult=1.0f/(cell_size);
+
+	sf::Vector2f a=p1*mult+sf::Vector2f(0.5f,0.5f);
+	sf::Vector2f b=(p2-p1)*mult;
+
+	sf::Vector2f start=a+b*t_min;
+	int x=std::floor(start.x);
+	int y=std::floor(start.y);
+
+	int step_x=(b.x>0) ? 1 : -1;
+	int step_y=(b.y>0) ? 1 : -1;
+
+	float inf=std::numeric_limits<float>::infinity();
+	float t_delta_x=(b.x!=0) ? std::fabs(1.0f/b.x) : inf;
+	float t_delta_y=(b.y!=0) ? std::fabs(1.0f/b.y) : inf;
+	float t_next_x=(b.x!=0) ? ((float)(x+(step_x>0 ? 1 : 0))-a.x)/b.x : inf;
+	float t_next_y=(b.y!=0) ? ((float)(y+(step_y>0 ? 1 : 0))-a.y)/b.y : inf;
+
+	float t=t_min;
+	while(t<=t_max) {
+		if(x>=0 && y>=0 && x<w && y<h) {
+			if(cells.get(x,y)) {
+				out_t=t;
+				chunk.island=this;
+				chunk.chunk_index=y*w+x;
+				return true;
+			}
+		}
+		else if((x<0 && step_x<0) || (x>=w && step_x>0) || (y<0 && step_y<0) || (y>=h && step_y>0)) {
+			break;	//left the map for good
+		}
+
+		if(t_next_x<t_next_y) {
+			t=std::max(t,t_next_x);
+			x+=step_x;
+			t_next_x+=t_delta_x;
+		}
+		else {
+			t=std::max(t,t_next_y);
+			y+=step_y;
+			t_next_y+=t_delta_y;
+		}
+	}
+	return false;
+}
 Texture TerrainIsland::generate_icon_texture() {
-	if(!map) {
+	if(!generated) {
 		return Texture();
 	}
 
@@ -642,7 +1272,7 @@ Texture TerrainIsland::generate_icon_texture() {
 	return Texture(tex);
 }
 void TerrainIsland::generate_icon_texture(sf::Texture* tex) {
-	if(!map) {
+	if(!generated) {
 		return;
 	}
 
@@ -654,7 +1284,7 @@ void TerrainIsland::generate_icon_texture(sf::Texture* tex) {
 			dst[0]=128;
 			dst[1]=128;
 			dst[2]=128;
-			dst[3]= (map[y*w+x].active ? 255 : 0);
+			dst[3]= (cells.get(x,y) ? 255 : 0);
 		}
 	}
 
@@ -665,38 +1295,161 @@ void TerrainIsland::generate_icon_texture(sf::Texture* tex) {
 
 
 
+TerrainPool::TerrainPool(int _class_step,std::size_t _max_free_bytes) {
+	class_step=_class_step;
+	max_free_bytes=_max_free_bytes;
+	tick=0;
+}
+TerrainPool::~TerrainPool() {
+	for(FreeTexture& t : free_textures) {
+		delete(t.texture);
+	}
+	for(FreePixels& p : free_pixels) {
+		delete(p.pixels);
+	}
+}
+sf::Vector2u TerrainPool::size_class(int width,int height) const {
+	return sf::Vector2u(
+			(width+class_step-1)/class_step*class_step,
+			(height+class_step-1)/class_step*class_step);
+}
+//drops oldest free objects over max_free_bytes
+void TerrainPool::trim() {
+	while(stats.free_bytes>max_free_bytes) {
+		bool texture_older=!free_textures.empty();
+		if(texture_older && !free_pixels.empty()) {
+			texture_older=(free_textures.front().release_tick<free_pixels.front().release_tick);
+		}
+		if(texture_older) {
+			FreeTexture& t=free_textures.front();
+			std::size_t bytes=t.size.x*t.size.y*t.channels;
+			delete(t.texture);
+			free_textures.erase(free_textures.begin());
+			stats.free_bytes-=bytes;
+			stats.resident_bytes-=bytes;
+		}
+		else {
+			FreePixels& p=free_pixels.front();
+			std::size_t bytes=p.pixels->data_size;
+			delete(p.pixels);
+			free_pixels.erase(free_pixels.begin());
+			stats.free_bytes-=bytes;
+			stats.resident_bytes-=bytes;
+		}
+	}
+}
+sf::Texture* TerrainPool::get_texture(int width,int height,int channels) {
+	sf::Vector2u size=size_class(width,height);
+	for(int i=(int)free_textures.size()-1;i>=0;i--) {
+		if(free_textures[i].size==size && free_textures[i].channels==channels) {
+			sf::Texture* texture=free_textures[i].texture;
+			free_textures.erase(free_textures.begin()+i);
+			stats.free_bytes-=size.x*size.y*channels;
+			stats.hits++;
+			return texture;
+		}
+	}
+	stats.misses++;
+	stats.resident_bytes+=size.x*size.y*channels;
+
+	sf::Texture* texture=new sf::Texture();
+	texture->create(size.x,size.y);
+	texture->setSmooth(false);
+	if(channels==1) {
+		alpha_storage(texture,NULL);
+	}
+	return texture;
+}
+void TerrainPool::put_texture(sf::Texture* texture,int channels) {
+	if(!texture) {
+		return;
+	}
+	FreeTexture t;
+	t.size=texture->getSize();
+	t.channels=channels;
+	t.texture=texture;
+	t.release_tick=tick++;
+	free_textures.push_back(t);
+	stats.free_bytes+=t.size.x*t.size.y*channels;
+	trim();
+}
+void TerrainPool::get_pixels(int width,int height,ImageData& out,int channels) {
+	sf::Vector2u size=size_class(width,height);
+	ImageData* pixels=NULL;
+	for(int i=(int)free_pixels.size()-1;i>=0;i--) {
+		if(free_pixels[i].size==size && free_pixels[i].channels==channels) {
+			pixels=free_pixels[i].pixels;
+			free_pixels.erase(free_pixels.begin()+i);
+			stats.free_bytes-=pixels->data_size;
+			stats.hits++;
+			memset(pixels->data,0,pixels->data_size);
+			break;
+		}
+	}
+	if(!pixels) {
+		stats.misses++;
+		pixels=new ImageData();
+		pixels->create(size.x,size.y,channels);
+		stats.resident_bytes+=pixels->data_size;
+	}
+	out.unload();
+	out.swap(*pixels);
+	delete(pixels);
+}
+void TerrainPool::put_pixels(ImageData& data) {
+	if(!data.data) {
+		return;
+	}
+	FreePixels p;
+	p.size=data.size;
+	p.channels=data.channels;
+	p.pixels=new ImageData();
+	p.pixels->swap(data);
+	p.release_tick=tick++;
+	free_pixels.push_back(p);
+	stats.free_bytes+=p.pixels->data_size;
+	trim();
+}
+
+
 void Terrain::add_island(TerrainIsland* island) {
+	island->index=islands.size();
 	add_child(island);
 	islands.push_back(island);
-	TerrainIsland::loader->add_task(new TerrainLoaderTaskInit(island));
 }
 
-namespace {
-	void render_octree(Node* node,const Octree<TerrainIsland*>& tree) {
-
-		Node* foo=new Node();
-		foo->type=Node::TYPE_SOLID;
-		foo->pos=tree.quad.p1;
-		foo->scale=(tree.quad.p2-tree.quad.p1);
-		foo->color.set(Utils::rand_range(0.1,1),Utils::rand_range(0.1,1),Utils::rand_range(0.1,1),0.1);
-		node->add_child(foo);
-
-		for(int i=0;i<4;i++) {
-			if(tree.children[i]) {
-				render_octree(node,*tree.children[i]);
-			}
-		}
-	}
-}
+Terrain::Terrain(uint32_t _world_seed) {
 
-Terrain::Terrain() {
+	world_seed=_world_seed;
+	journal.world_seed=world_seed;
 
 	field_size=sf::Vector2f(30000,30000);
-	octree.reset(Quad(sf::Vector2f(0,0),field_size),7);
+	upload_budget=4*1024*1024;
+
+	prefetch_margin=256;
+	prefetch_time=1.0;
+	unload_margin=1024;
+	unload_grace=2.0;
+
+	cache_budget=256*1024*1024;
+	cache_bytes=0;
+
+	baking=false;
+	bake_remaining=0;
+
+	occupancy_cell_size=16;
+	occupancy.create(
+			std::ceil(field_size.x/occupancy_cell_size),
+			std::ceil(field_size.y/occupancy_cell_size));
 
 	sf::Vector2f rock_count(50,50);
 	sf::Vector2f cell_size(field_size.x/rock_count.x,field_size.y/rock_count.y);
 
+	island_grid.reset(field_size,cell_size.x);
+
+	generated_regions.create(rock_count.x,rock_count.y);
+	region_size=cell_size;
+
 	for(int x=0;x<rock_count.x;x++) {
 		for(int y=0;y<rock_count.y;y++) {
 
@@ -708,18 +1461,24 @@ Terrain::Terrain() {
 			bp1-=cell_size*0.3f;
 			bp2+=cell_size*0.3f;
 
-			sf::Vector2f p1(Utils::rand_range(bp1.x,bp1.x+(bp2.x-bp1.x)*0.4),Utils::rand_range(bp1.y,bp1.y+(bp2.y-bp1.y)*0.4));
-			sf::Vector2f p2(Utils::rand_range(bp1.x+(bp2.x-bp1.x)*0.6,bp2.x),Utils::rand_range(bp1.y+(bp2.y-bp1.y)*0.6,bp2.y));
+			uint32_t seed=Utils::hash32(world_seed,islands.size());
+
+			sf::Vector2f p1(
+					Utils::hash_range(Utils::hash32(seed,3),bp1.x,bp1.x+(bp2.x-bp1.x)*0.4),
+					Utils::hash_range(Utils::hash32(seed,4),bp1.y,bp1.y+(bp2.y-bp1.y)*0.4));
+			sf::Vector2f p2(
+					Utils::hash_range(Utils::hash32(seed,5),bp1.x+(bp2.x-bp1.x)*0.6,bp2.x),
+					Utils::hash_range(Utils::hash32(seed,6),bp1.y+(bp2.y-bp1.y)*0.6,bp2.y));
 
 			p1.x=std::max(0.0f,std::min(p1.x,field_size.x));
 			p1.y=std::max(0.0f,std::min(p1.y,field_size.y));
 			p2.x=std::max(0.0f,std::min(p2.x,field_size.x));
 			p2.y=std::max(0.0f,std::min(p2.y,field_size.y));
 
-			TerrainIsland* island=new TerrainIsland(Quad(p1,p2));	//leak
+			TerrainIsland* island=new TerrainIsland(Quad(p1,p2),seed);	//leak
 			add_island(island);
 
-			octree.put(Quad(p1,p2),island);
+			island_grid.insert(Quad(p1,p2),island);
 			/*
 			Node* foo=new Node();
 			foo->type=Node::TYPE_SOLID;
@@ -733,8 +1492,6 @@ Terrain::Terrain() {
 
 	printf("%ld islands\n",islands.size());
 
-	//render_octree(this,octree);
-
 
 	/*
 	sf::Vector2f pos(500,0);
@@ -758,39 +1515,16 @@ Terrain::Terrain() {
 }
 
 
-//handles terrain wrapping
-SimpleList<TerrainIsland*>& Terrain::list_islands(const Quad& _quad) {
-	Quad area_quad(sf::Vector2f(0,0),field_size);
-	Quad quad=_quad.mod(area_quad);
-
-	SimpleList<TerrainIsland*>& list=octree.query(quad);
-
-	bool overflow_x=(quad.p2.x>octree.quad.p2.x);
-	bool overflow_y=(quad.p2.y>octree.quad.p2.y);
-	sf::Vector2f tree_size=octree.quad.size();
-
-	if(overflow_x) {
-		Quad q=quad;
-		q.p1.x-=tree_size.x;
-		q.p2.x-=tree_size.x;
-		octree.query_list(q,list);
-	}
-	if(overflow_y) {
-		Quad q=quad;
-		q.p1.y-=tree_size.y;
-		q.p2.y-=tree_size.y;
-		octree.query_list(q,list);
-	}
-	if(overflow_x && overflow_y) {
-		Quad q=quad;
-		q.p1-=tree_size;
-		q.p2-=tree_size;
-		octree.query_list(q,list);
-	}
-	return list;
+SimpleList<TerrainIsland*>& Terrain::list_islands(const Quad& quad) {
+	island_list.clear();
+	island_grid.query(quad,island_query,island_list);
+	return island_list;
+}
+void Terrain::list_islands(const Quad& quad,ToroidalGrid<TerrainIsland*>::Query& query,SimpleList<TerrainIsland*>& out) const {
+	island_grid.query(quad,query,out);
 }
 
-void Terrain::update_visual(const sf::FloatRect& _rect) {
+void Terrain::update_visual(const sf::FloatRect& _rect,const sf::Vector2f& velocity,float dt) {
 
 	sf::Vector2f offset;
 	sf::FloatRect rect=_rect;
@@ -812,46 +1546,138 @@ void Terrain::update_visual(const sf::FloatRect& _rect) {
 		offset.y-=field_size.y;
 	}
 
+	int budget=upload_budget;
+
+	sf::Vector2f center(rect.left+rect.width*0.5f,rect.top+rect.height*0.5f);
+	TerrainIsland::loader->set_focus(center,field_size);
+
 	sf::Vector2f p1(_rect.left,_rect.top);
 	sf::Vector2f p2=p1+sf::Vector2f(_rect.width,_rect.height);
-	Quad query_quad(p1,p2);
-	const SimpleList<TerrainIsland*>& list=list_islands(query_quad);
 
+	//islands are loaded and rasterized ahead of the camera, stretched along velocity
+	sf::Vector2f margin(prefetch_margin,prefetch_margin);
+	Quad prefetch_quad(p1-margin,p2+margin);
+	sf::Vector2f ahead=velocity*prefetch_time;
+	if(ahead.x>0) prefetch_quad.p2.x+=ahead.x;
+	else prefetch_quad.p1.x+=ahead.x;
+	if(ahead.y>0) prefetch_quad.p2.y+=ahead.y;
+	else prefetch_quad.p1.y+=ahead.y;
+
+	//and unloaded only after leaving the larger keep area for unload_grace seconds
+	margin=sf::Vector2f(unload_margin,unload_margin);
+	Quad keep_quad(p1-margin,p2+margin);
+	keep_quad.p1.x=std::min(keep_quad.p1.x,prefetch_quad.p1.x);
+	keep_quad.p1.y=std::min(keep_quad.p1.y,prefetch_quad.p1.y);
+	keep_quad.p2.x=std::max(keep_quad.p2.x,prefetch_quad.p2.x);
+	keep_quad.p2.y=std::max(keep_quad.p2.y,prefetch_quad.p2.y);
+
+	const SimpleList<TerrainIsland*>& list=list_islands(prefetch_quad);
+
+	SimpleList<TerrainIsland*> kept;
 	for(int i=0;i<loaded_islands.size();i++) {
 		TerrainIsland* island=loaded_islands[i];
-		if(!list.contains(island)) {
+		if(list.contains(island)) {
+			continue;
+		}
+		if(island_intersects(island,keep_quad)) {
+			island->unload_timer=0;
+		}
+		else {
+			island->unload_timer+=dt;
+		}
+		if(island->unload_timer>=unload_grace) {
 			island->unload();
+			//islands still waiting for their cells have nothing to cache
+			if(island->is_cached()) {
+				cache_insert(island);
+			}
+			continue;
 		}
+		kept.push_back(island);
 	}
 	loaded_islands.clear();
-
 	for(int i=0;i<list.size();i++) {
 		TerrainIsland* island=list[i];
-		/*
-		if(!island->box.intersects(query_quad)) {
-			continue;
+		request_generation(island,TerrainLoaderTask::PRIORITY_VISIBLE);
+		island->unload_timer=0;
+		if(island->is_cached()) {
+			cache_remove(island);
 		}
-		*/
+		loaded_islands.push_back(island);
+	}
+	for(TerrainIsland* island : cached_islands) {
+		island->cache_age+=dt;
+	}
+	cache_trim();
+	for(int i=0;i<kept.size();i++) {
+		loaded_islands.push_back(kept[i]);
+	}
 
-		sf::FloatRect r1=rect;
+	//prefetch and keep rects in the field copy of rect
+	sf::FloatRect prefetch_rect(
+			prefetch_quad.p1-offset,
+			prefetch_quad.p2-prefetch_quad.p1);
+	sf::FloatRect keep_rect(
+			keep_quad.p1-offset,
+			keep_quad.p2-keep_quad.p1);
 
-		island->offset=offset;
+	for(int i=0;i<loaded_islands.size();i++) {
+		TerrainIsland* island=loaded_islands[i];
 
-		if(island->box.p2.x<rect.left) {
-			island->offset.x+=field_size.x;
-			r1.left-=field_size.x;
-		}
-		if(island->box.p2.y<rect.top) {
-			island->offset.y+=field_size.y;
-			r1.top-=field_size.y;
-		}
+		//draw the island copy closest to the camera
+		sf::Vector2f shift;
+		sf::Vector2f diff=(island->box.p1+island->box.p2)*0.5f-center;
+		if(diff.x>field_size.x*0.5f) shift.x=-field_size.x;
+		else if(diff.x<-field_size.x*0.5f) shift.x=field_size.x;
+		if(diff.y>field_size.y*0.5f) shift.y=-field_size.y;
+		else if(diff.y<-field_size.y*0.5f) shift.y=field_size.y;
+
+		island->offset=offset+shift;
 		island->pos=island->box.p1+island->offset;
 
-		r1.left-=island->box.p1.x;
-		r1.top-=island->box.p1.y;
+		sf::FloatRect r1=prefetch_rect;
+		r1.left-=island->box.p1.x+shift.x;
+		r1.top-=island->box.p1.y+shift.y;
+		sf::FloatRect r2=keep_rect;
+		r2.left-=island->box.p1.x+shift.x;
+		r2.top-=island->box.p1.y+shift.y;
 
-		island->update_visual(r1);
-		loaded_islands.push_back(island);
+		island->update_visual(r1,r2,budget);
+	}
+}
+
+void Terrain::cache_insert(TerrainIsland* island) {
+	std::size_t bytes=island->get_resident_bytes();
+	cached_islands.push_back(island);
+	cached_bytes.push_back(bytes);
+	cache_bytes+=bytes;
+}
+void Terrain::cache_remove(TerrainIsland* island) {
+	for(std::size_t i=0;i<cached_islands.size();i++) {
+		if(cached_islands[i]==island) {
+			cache_bytes-=cached_bytes[i];
+			cached_islands.erase(cached_islands.begin()+i);
+			cached_bytes.erase(cached_bytes.begin()+i);
+			return;
+		}
+	}
+}
+//evicts by size times age until the cache fits the budget
+void Terrain::cache_trim() {
+	while(cache_bytes>cache_budget && !cached_islands.empty()) {
+		int victim=0;
+		float victim_score=-1;
+		for(std::size_t i=0;i<cached_islands.size();i++) {
+			TerrainIsland* island=cached_islands[i];
+			float score=(float)cached_bytes[i]*(island->cache_age+1.0f);
+			if(score>victim_score) {
+				victim=i;
+				victim_score=score;
+			}
+		}
+		TerrainIsland* island=cached_islands[victim];
+		cache_remove(island);
+		island->evict();
 	}
 }
 
@@ -860,54 +1686,368 @@ void Terrain::damage_area(const sf::FloatRect& rect,float damage) {
 	sf::Vector2f p2=p1+sf::Vector2f(rect.width,rect.height);
 	const SimpleList<TerrainIsland*>& list=list_islands(Quad(p1,p2));
 
+	bool changed=false;
 	for(int i=0;i<list.size();i++) {
 		TerrainIsland* island=list[i];
+		island->generate(this);
 
 		sf::FloatRect r1=rect;
 		r1.left-=island->box.p1.x+island->offset.x;
 		r1.top-=island->box.p1.y+island->offset.y;
-		island->damage_area(r1,damage);
+		if(damage_island(island,island->get_cell_range(r1),damage)) {
+			changed=true;
+		}
+	}
+
+	if(changed) {
+		sf::Vector2f margin(occupancy_cell_size,occupancy_cell_size);
+		occupancy_update(Quad(p1-margin,p2+margin));
 	}
 }
 bool Terrain::check_collision(const sf::FloatRect& rect) {
-	sf::Vector2f p1=sf::Vector2f(rect.left,rect.top);
-	sf::Vector2f p2=p1+sf::Vector2f(rect.width,rect.height);
-	SimpleList<TerrainIsland*>& list=list_islands(Quad(p1,p2));
+	generate_area(Quad(sf::Vector2f(rect.left,rect.top),sf::Vector2f(rect.left+rect.width,rect.top+rect.height)));
+
+	float mult=1.0f/occupancy_cell_size;
+	return occupancy_any(
+			std::floor(rect.left*mult),
+			std::floor(rect.top*mult),
+			std::floor((rect.left+rect.width)*mult)+1,
+			std::floor((rect.top+rect.height)*mult)+1);
+}
+bool Terrain::check_collision(const sf::FloatRect& rect,sf::Vector2f& normal) {
+	generate_area(Quad(sf::Vector2f(rect.left,rect.top),sf::Vector2f(rect.left+rect.width,rect.top+rect.height)));
 
-	for(int i=0;i<list.size();i++) {
-		TerrainIsland* island=list[i];
+	float mult=1.0f/occupancy_cell_size;
 
-		sf::FloatRect r1=rect;
-		r1.left-=island->box.p1.x+island->offset.x;
-		r1.top-=island->box.p1.y+island->offset.y;
-		if(island->check_collision(r1)) {
-			return true;
+	normal.x=normal.y=0.0f;
+
+	sf::Vector2f cell_sum;
+	int count=occupancy_sum(
+			std::floor(rect.left*mult),
+			std::floor(rect.top*mult),
+			std::floor((rect.left+rect.width)*mult)+1,
+			std::floor((rect.top+rect.height)*mult)+1,
+			cell_sum);
+	if(count==0) {
+		return false;
+	}
+
+	//sum of (rect_p-cell center) over active cells
+	sf::Vector2f rect_p=sf::Vector2f(rect.left,rect.top)+sf::Vector2f(rect.width,rect.height)*0.5f;
+	rect_p=rect_p*mult-sf::Vector2f(0.5f,0.5f);
+	normal=rect_p*(float)count-cell_sum;
+	normal=Utils::vec_normalize(normal);
+	return true;
+}
+
+namespace {
+	//splits [a1,a2) into at most two ranges inside [0,size), shift maps range back to unwrapped coords
+	int wrap_range(int a1,int a2,int size,int* from,int* to,int* shift) {
+		if(a2-a1>size) {
+			a2=a1+size;
+		}
+		int s=a1%size;
+		if(s<0) s+=size;
+		s=a1-s;
+		a1-=s;
+		a2-=s;
+
+		from[0]=a1;
+		to[0]=std::min(a2,size);
+		shift[0]=s;
+		if(a2<=size) {
+			return 1;
 		}
+		from[1]=0;
+		to[1]=a2-size;
+		shift[1]=s+size;
+		return 2;
 	}
-	return false;
 }
-bool Terrain::check_collision(const sf::FloatRect& rect,sf::Vector2f& normal) {
-	sf::Vector2f p1=sf::Vector2f(rect.left,rect.top);
-	sf::Vector2f p2=p1+sf::Vector2f(rect.width,rect.height);
-	SimpleList<TerrainIsland*>& list=list_islands(Quad(p1,p2));
 
-	for(int i=0;i<list.size();i++) {
-		TerrainIsland* island=list[i];
+bool Terrain::occupancy_any(int x1,int y1,int x2,int y2) {
+	if(x1>=x2 || y1>=y2) {
+		return false;
+	}
+	int fx[2],tx[2],sx[2],fy[2],ty[2],sy[2];
+	int nx=wrap_range(x1,x2,occupancy.w,fx,tx,sx);
+	int ny=wrap_range(y1,y2,occupancy.h,fy,ty,sy);
+	bool found=false;
+	occupancy_mutex.lock();
+	for(int j=0;j<ny && !found;j++) {
+		for(int i=0;i<nx && !found;i++) {
+			found=occupancy.any(fx[i],fy[j],tx[i],ty[j]);
+		}
+	}
+	occupancy_mutex.unlock();
+	return found;
+}
+int Terrain::occupancy_sum(int x1,int y1,int x2,int y2,sf::Vector2f& out_sum) {
+	out_sum=sf::Vector2f(0,0);
+	if(x1>=x2 || y1>=y2) {
+		return 0;
+	}
+	int fx[2],tx[2],sx[2],fy[2],ty[2],sy[2];
+	int nx=wrap_range(x1,x2,occupancy.w,fx,tx,sx);
+	int ny=wrap_range(y1,y2,occupancy.h,fy,ty,sy);
+	int count=0;
+	occupancy_mutex.lock();
+	for(int j=0;j<ny;j++) {
+		for(int i=0;i<nx;i++) {
+			sf::Vector2f sum;
+			int n=occupancy.sum(fx[i],fy[j],tx[i],ty[j],sum);
+			out_sum+=sum+sf::Vector2f(sx[i],sy[j])*(float)n;
+			count+=n;
+		}
+	}
+	occupancy_mutex.unlock();
+	return count;
+}
+//makes sure every island touching quad is generated, regions remember when all of theirs are
+void Terrain::generate_area(const Quad& quad) {
+	int x1=std::floor(quad.p1.x/region_size.x);
+	int y1=std::floor(quad.p1.y/region_size.y);
+	int x2=std::floor(quad.p2.x/region_size.x)+1;
+	int y2=std::floor(quad.p2.y/region_size.y)+1;
+
+	int fx[2],tx[2],sx[2],fy[2],ty[2],sy[2];
+	int nx=wrap_range(x1,x2,generated_regions.w,fx,tx,sx);
+	int ny=wrap_range(y1,y2,generated_regions.h,fy,ty,sy);
+
+	for(int j=0;j<ny;j++) {
+		for(int i=0;i<nx;i++) {
+			for(int y=fy[j];y<ty[j];y++) {
+				for(int x=fx[i];x<tx[i];x++) {
+					if(generated_regions.get(x,y)) {
+						continue;
+					}
+					Quad region(
+							sf::Vector2f(x*region_size.x,y*region_size.y),
+							sf::Vector2f((x+1)*region_size.x,(y+1)*region_size.y));
+					ToroidalGrid<TerrainIsland*>::Query query;
+					SimpleList<TerrainIsland*> list;
+					list_islands(region,query,list);
+					for(int k=0;k<list.size();k++) {
+						list[k]->generate(this);
+					}
+
+					region_mutex.lock();
+					generated_regions.set(x,y,true);
+					region_mutex.unlock();
+				}
+			}
+		}
+	}
+}
+void Terrain::generate_all(int thread_count) {
+	//islands only write their own cells and OR into occupancy, so order doesn't matter
+	ParallelFor pool(thread_count);
+	pool.run(islands.size(),[this](int i) {
+		islands[i]->generate(this);
+	});
+
+	region_mutex.lock();
+	for(int y=0;y<generated_regions.h;y++) {
+		for(int x=0;x<generated_regions.w;x++) {
+			generated_regions.set(x,y,true);
+		}
+	}
+	region_mutex.unlock();
+}
+bool Terrain::open_world_file(const std::string& path) {
+	bool valid=world_file.open(path);
+	if(valid) {
+		const TerrainWorldFile::Header& header=world_file.get_header();
+		valid=(header.world_seed==world_seed &&
+				header.island_count==islands.size() &&
+				header.field_w==field_size.x && header.field_h==field_size.y &&
+				header.occupancy_w==occupancy.w && header.occupancy_h==occupancy.h);
+		for(int i=0;i<(int)islands.size() && valid;i++) {
+			const TerrainWorldFile::Island& entry=world_file.get_island(i);
+			const TerrainIsland* island=islands[i];
+			valid=(entry.seed==island->get_seed() && sf::Vector2i(entry.w,entry.h)==island->get_cell_count() &&
+					entry.x1==island->box.p1.x && entry.y1==island->box.p1.y &&
+					entry.x2==island->box.p2.x && entry.y2==island->box.p2.y);
+		}
+		if(!valid) {
+			printf("world file %s doesn't match world %u\n",path.c_str(),world_seed);
+			world_file.close();
+		}
+	}
 
-		sf::FloatRect r1=rect;
-		r1.left-=island->box.p1.x+island->offset.x;
-		r1.top-=island->box.p1.y+island->offset.y;
-		if(island->check_collision(r1,normal)) {
-			return true;
+	if(valid) {
+		//cells point into the private mapping, pages load as islands are touched
+		const TerrainWorldFile::Header& header=world_file.get_header();
+		for(int i=0;i<(int)islands.size();i++) {
+			const TerrainWorldFile::Island& entry=world_file.get_island(i);
+			islands[i]->attach_cells(entry.w,entry.h,world_file.get_words(entry.cells_offset));
+		}
+		occupancy_mutex.lock();
+		occupancy.attach(header.occupancy_w,header.occupancy_h,world_file.get_words(header.occupancy_offset));
+		occupancy_mutex.unlock();
+
+		region_mutex.lock();
+		for(int y=0;y<generated_regions.h;y++) {
+			for(int x=0;x<generated_regions.w;x++) {
+				generated_regions.set(x,y,true);
+			}
+		}
+		region_mutex.unlock();
+		return true;
+	}
+
+	if(!TerrainWorldFile::writable(path)) {
+		printf("can't write world file %s, not baking\n",path.c_str());
+		return false;
+	}
+	for(int i=0;i<(int)islands.size();i++) {
+		if(islands[i]->is_generated()) {
+			printf("terrain already in use, not baking %s\n",path.c_str());
+			return false;
 		}
 	}
+
+	bake_path=path;
+	bake_cells.assign(islands.size(),std::vector<uint64_t>());
+	bake_occupancy.create(occupancy.w,occupancy.h);
+	bake_remaining=islands.size();
+	baking=true;
+	//not through request_generation, visible requests for the same islands must still get queued
+	for(int i=0;i<(int)islands.size();i++) {
+		TerrainIsland::loader->add_task(new TerrainLoaderTaskInit(this,islands[i],TerrainLoaderTask::PRIORITY_INIT));
+	}
 	return false;
 }
+void Terrain::bake_world_file() {
+	TerrainWorldFile::Header header;
+	header.world_seed=world_seed;
+	header.field_w=field_size.x;
+	header.field_h=field_size.y;
+	header.occupancy_w=bake_occupancy.w;
+	header.occupancy_h=bake_occupancy.h;
+	header.occupancy_stride=bake_occupancy.stride;
+
+	std::vector<TerrainWorldFile::Island> entries(islands.size());
+	std::vector<const uint64_t*> cells(islands.size());
+	for(int i=0;i<(int)islands.size();i++) {
+		const TerrainIsland* island=islands[i];
+		TerrainWorldFile::Island& entry=entries[i];
+		entry.x1=island->box.p1.x;
+		entry.y1=island->box.p1.y;
+		entry.x2=island->box.p2.x;
+		entry.y2=island->box.p2.y;
+		sf::Vector2i count=island->get_cell_count();
+		entry.seed=island->get_seed();
+		entry.w=count.x;
+		entry.h=count.y;
+		entry.stride=(count.x+63)/64;
+		entry.cells_offset=0;
+		cells[i]=&bake_cells[i][0];
+	}
+	if(TerrainWorldFile::write(bake_path,header,entries,cells,bake_occupancy.words)) {
+		printf("baked world file %s\n",bake_path.c_str());
+	}
+
+	std::vector<std::vector<uint64_t> >().swap(bake_cells);
+	bake_occupancy.release();
+	baking=false;
+}
+void Terrain::request_generation(TerrainIsland* island,TerrainLoaderTask::Priority priority) {
+	if(island->is_generated() || island->generate_queued.exchange(true)) {
+		return;
+	}
+	TerrainIsland::loader->add_task(new TerrainLoaderTaskInit(this,island,priority));
+}
+
+void Terrain::occupancy_update(const Quad& quad) {
+	float mult=1.0f/occupancy_cell_size;
+	int x1=std::floor(quad.p1.x*mult);
+	int y1=std::floor(quad.p1.y*mult);
+	int x2=std::floor(quad.p2.x*mult)+1;
+	int y2=std::floor(quad.p2.y*mult)+1;
+
+	int fx[2],tx[2],sx[2],fy[2],ty[2],sy[2];
+	int nx=wrap_range(x1,x2,occupancy.w,fx,tx,sx);
+	int ny=wrap_range(y1,y2,occupancy.h,fy,ty,sy);
+
+	//own buffers, callers may be iterating list_islands() results
+	ToroidalGrid<TerrainIsland*>::Query query;
+	SimpleList<TerrainIsland*> list;
+	list_islands(quad,query,list);
+
+	occupancy_mutex.lock();
+	for(int j=0;j<ny;j++) {
+		for(int i=0;i<nx;i++) {
+			for(int y=fy[j];y<ty[j];y++) {
+				for(int x=fx[i];x<tx[i];x++) {
+					sf::FloatRect r(x*occupancy_cell_size,y*occupancy_cell_size,occupancy_cell_size,occupancy_cell_size);
+					bool active=false;
+					for(int k=0;k<list.size() && !active;k++) {
+						sf::FloatRect r1=r;
+						r1.left-=list[k]->box.p1.x;
+						r1.top-=list[k]->box.p1.y;
+						active=list[k]->check_collision(r1);
+					}
+					occupancy.set(x,y,active);
+				}
+			}
+		}
+	}
+	occupancy_mutex.unlock();
+}
+void Terrain::occupancy_add(TerrainIsland* island) {
+	float mult=1.0f/occupancy_cell_size;
+	int x1=std::max(0,(int)std::floor(island->box.p1.x*mult));
+	int y1=std::max(0,(int)std::floor(island->box.p1.y*mult));
+	int x2=std::min(occupancy.w,(int)std::floor(island->box.p2.x*mult)+1);
+	int y2=std::min(occupancy.h,(int)std::floor(island->box.p2.y*mult)+1);
+
+	if(x1>=x2 || y1>=y2) {
+		return;
+	}
+
+	//sample outside the lock so parallel generation doesn't serialize here
+	BitGrid local;
+	local.create(x2-x1,y2-y1);
+	for(int y=y1;y<y2;y++) {
+		for(int x=x1;x<x2;x++) {
+			sf::FloatRect r(x*occupancy_cell_size-island->box.p1.x,y*occupancy_cell_size-island->box.p1.y,
+					occupancy_cell_size,occupancy_cell_size);
+			if(island->check_cells(r)) {
+				local.set(x-x1,y-y1,true);
+			}
+		}
+	}
+
+	//cells are still as generated here, generated isn't set so nothing has damaged them
+	bool bake=baking;
+	if(bake) {
+		const BitGrid& grid=island->get_cells();
+		bake_cells[island->index].assign(grid.words,grid.words+grid.stride*grid.h);
+	}
+
+	occupancy_mutex.lock();
+	for(int y=y1;y<y2;y++) {
+		for(int x=x1;x<x2;x++) {
+			if(local.get(x-x1,y-y1)) {
+				occupancy.set(x,y,true);
+				if(bake) {
+					bake_occupancy.set(x,y,true);
+				}
+			}
+		}
+	}
+	occupancy_mutex.unlock();
+
+	if(bake && --bake_remaining==0) {
+		bake_world_file();
+	}
+}
 
 TerrainIsland* Terrain::get_island_at_point(const sf::Vector2f& pos) {
 	//pos not wraped!
 
-	SimpleList<TerrainIsland*>& list=octree.query(pos);
+	SimpleList<TerrainIsland*>& list=list_islands(Quad(pos,pos));
 	for(int i=0;i<list.size();i++) {
 		TerrainIsland* island=list[i];
 
@@ -925,6 +2065,15 @@ bool Terrain::check_collision(sf::Vector2f pos,TerrainIsland::ChunkAddress& chun
 	if(pos.x<0) pos.x+=field_size.x;
 	if(pos.y<0) pos.y+=field_size.y;
 
+	generate_area(Quad(pos,pos));
+
+	float mult=1.0f/occupancy_cell_size;
+	int x=std::floor(pos.x*mult);
+	int y=std::floor(pos.y*mult);
+	if(!occupancy_any(x,y,x+1,y+1)) {
+		return false;
+	}
+
 	TerrainIsland* island=get_island_at_point(pos);
 	if(!island) {
 		return false;
@@ -970,33 +2119,228 @@ bool Terrain::island_intersects(TerrainIsland* island,const Quad& _quad) {
 
 	return false;
 }
-Terrain::RayQuery Terrain::query_ray(const sf::Vector2f& start,const sf::Vector2f& end) {
-	Terrain::RayQuery query;
+namespace {
+	//clips p1+d*t to box, t stays within [t0,t1]
+	bool segment_clip(const sf::Vector2f& p1,const sf::Vector2f& d,const Quad& box,float& t0,float& t1) {
+		const float p[2]={p1.x,p1.y};
+		const float dir[2]={d.x,d.y};
+		const float lo[2]={box.p1.x,box.p1.y};
+		const float hi[2]={box.p2.x,box.p2.y};
+
+		for(int i=0;i<2;i++) {
+			if(dir[i]==0) {
+				if(p[i]<lo[i] || p[i]>hi[i]) {
+					return false;
+				}
+				continue;
+			}
+			float ta=(lo[i]-p[i])/dir[i];
+			float tb=(hi[i]-p[i])/dir[i];
+			if(ta>tb) {
+				std::swap(ta,tb);
+			}
+			t0=std::max(t0,ta);
+			t1=std::min(t1,tb);
+			if(t0>t1) {
+				return false;
+			}
+		}
+		return true;
+	}
 
-	float step=5.0f/Utils::vec_length(end-start);
+	class RayCandidate {
+	public:
+		TerrainIsland* island;
+		sf::Vector2f translation;
+		float t0;
+		float t1;
 
-	float pos=0.0f;
+		bool operator<(const RayCandidate& c) const {
+			return t0<c.t0;
+		}
+	};
+}
 
-	//TODO: lazy
-	while(pos<=1.0f) {
-		sf::Vector2f point=Utils::vec_lerp(start,end,pos);
+//DDA over island boxes (all wrapped copies the ray can reach), then over cells of each island in entry order
+Terrain::RayQuery Terrain::query_ray(const Ray& ray,const SimpleList<TerrainIsland*>& list) {
+	Terrain::RayQuery query;
 
-		if(check_collision(point,query.chunk_address)) {
-			query.hit=true;
-			query.hit_position=pos;
+	//work in the field copy containing the start
+	sf::Vector2f start=ray.start;
+	start.x=std::fmod(start.x,field_size.x);
+	start.y=std::fmod(start.y,field_size.y);
+	if(start.x<0) start.x+=field_size.x;
+	if(start.y<0) start.y+=field_size.y;
+	sf::Vector2f end=start+(ray.end-ray.start);
+	sf::Vector2f d=end-start;
 
+	std::vector<RayCandidate> candidates;
+	for(int i=0;i<list.size();i++) {
+		TerrainIsland* island=list[i];
+		island->generate(this);
+		for(int ty=-1;ty<=1;ty++) {
+			for(int tx=-1;tx<=1;tx++) {
+				RayCandidate c;
+				c.island=island;
+				c.translation=sf::Vector2f(tx*field_size.x,ty*field_size.y);
+				c.t0=0.0f;
+				c.t1=1.0f;
+				Quad box=island->box;
+				box.translate(c.translation);
+				if(segment_clip(start,d,box,c.t0,c.t1)) {
+					candidates.push_back(c);
+				}
+			}
+		}
+	}
+	std::sort(candidates.begin(),candidates.end());
+
+	for(const RayCandidate& c : candidates) {
+		if(query.hit && c.t0>query.hit_position) {
 			break;
 		}
-		pos+=step;
+		sf::Vector2f origin=c.island->box.p1+c.translation;
+		float t;
+		TerrainIsland::ChunkAddress chunk;
+		if(c.island->query_ray(start-origin,end-origin,c.t0,std::min(c.t1,query.hit_position),t,chunk)) {
+			if(!query.hit || t<query.hit_position) {
+				query.hit=true;
+				query.hit_position=t;
+				query.chunk_address=chunk;
+			}
+		}
 	}
 
 	return query;
 }
+Terrain::RayQuery Terrain::query_ray(const sf::Vector2f& start,const sf::Vector2f& end) {
+	Quad bbox(start,end);
+	bbox.sort_points();
+	return query_ray(Ray(start,end),list_islands(bbox));
+}
+//islands are listed once for the whole batch
+void Terrain::query_rays(const std::vector<Ray>& rays,std::vector<RayQuery>& out) {
+	out.resize(rays.size());
+	if(rays.empty()) {
+		return;
+	}
+
+	Quad bbox(rays[0].start,rays[0].start);
+	for(const Ray& ray : rays) {
+		bbox.p1.x=std::min(bbox.p1.x,std::min(ray.start.x,ray.end.x));
+		bbox.p1.y=std::min(bbox.p1.y,std::min(ray.start.y,ray.end.y));
+		bbox.p2.x=std::max(bbox.p2.x,std::max(ray.start.x,ray.end.x));
+		bbox.p2.y=std::max(bbox.p2.y,std::max(ray.start.y,ray.end.y));
+	}
+	const SimpleList<TerrainIsland*>& list=list_islands(bbox);
+
+	for(std::size_t i=0;i<rays.size();i++) {
+		out[i]=query_ray(rays[i],list);
+	}
+}
 void Terrain::damage_ray(const Terrain::RayQuery& ray,float damage) {
 	if(!ray.chunk_address.valid()) {
 		return;
 	}
-	ray.chunk_address.island->damage_chunk(ray.chunk_address.chunk_index,damage);
+	TerrainIsland* island=ray.chunk_address.island;
+	sf::Vector2i cells=island->get_cell_count();
+	int index=ray.chunk_address.chunk_index;
+	if(index>=cells.x*cells.y) {
+		return;
+	}
+	if(damage_island(island,sf::IntRect(index%cells.x,index/cells.x,1,1),damage)) {
+		sf::Vector2f pos=island->get_chunk_pos(ray.chunk_address.chunk_index);
+		sf::Vector2f margin(island->cell_size,island->cell_size);
+		occupancy_update(Quad(pos-margin,pos+margin));
+	}
+}
+bool Terrain::damage_island(TerrainIsland* island,const sf::IntRect& range,float damage) {
+	if(range.width<=0 || range.height<=0) {
+		return false;
+	}
+	TerrainJournal::Entry entry;
+	entry.island=island->index;
+	entry.x1=range.left;
+	entry.y1=range.top;
+	entry.x2=range.left+range.width;
+	entry.y2=range.top+range.height;
+	entry.pad=0;
+	entry.amount=damage;
+	return damage_entry(entry);
 }
+bool Terrain::damage_entry(const TerrainJournal::Entry& entry) {
+	TerrainIsland* island=islands[entry.island];
+	island->generate(this);
 
+	journal.append(entry);
+	bool changed=island->damage_cells(sf::IntRect(entry.x1,entry.y1,entry.x2-entry.x1,entry.y2-entry.y1),entry.amount);
 
+	if(journal.needs_compaction()) {
+		journal_checkpoint();
+	}
+	return changed;
+}
+void Terrain::journal_checkpoint() {
+	TerrainJournal::Checkpoint state;
+	for(int i=0;i<(int)islands.size();i++) {
+		if(islands[i]->is_damaged()) {
+			state.islands.push_back(TerrainJournal::IslandState());
+			islands[i]->get_state(state.islands.back());
+		}
+	}
+	journal.compact(state);
+}
+void Terrain::replay(const TerrainJournal::Entry* entries,int count) {
+	for(int i=0;i<count;i++) {
+		const TerrainJournal::Entry& entry=entries[i];
+		if(entry.island>=islands.size()) {
+			continue;
+		}
+		if(damage_entry(entry)) {
+			TerrainIsland* island=islands[entry.island];
+			float cs=island->cell_size;
+			sf::Vector2f p1=island->box.p1+sf::Vector2f(entry.x1-1,entry.y1-1)*cs;
+			sf::Vector2f p2=island->box.p1+sf::Vector2f(entry.x2,entry.y2)*cs;
+			occupancy_update(Quad(p1,p2));
+		}
+	}
+}
+bool Terrain::restore(const TerrainJournal& source,uint32_t position) {
+	if(&source==&journal) {
+		TerrainJournal copy=journal;
+		return restore(copy,position);
+	}
+	const TerrainJournal::Checkpoint& checkpoint=source.get_checkpoint();
+	if(source.world_seed!=world_seed || position<checkpoint.position || position>source.get_position()) {
+		return false;
+	}
+	//states may come from a file, each has to fit the island it names
+	for(const TerrainJournal::IslandState& state : checkpoint.islands) {
+		if(state.island>=islands.size()) {
+			return false;
+		}
+		sf::Vector2i count=islands[state.island]->get_cell_count();
+		if(state.cells.size()!=(std::size_t)((count.x+63)/64*count.y) ||
+				(!state.health.empty() && state.health.size()!=(std::size_t)(count.x*count.y))) {
+			return false;
+		}
+	}
+
+	//back to the checkpoint, islands damaged here but not there are regenerated
+	for(int i=0;i<(int)islands.size();i++) {
+		TerrainIsland* island=islands[i];
+		const TerrainJournal::IslandState* state=checkpoint.find(i);
+		if(!state && !island->is_damaged()) {
+			continue;
+		}
+		island->generate(this);
+		island->set_state(state);
+		occupancy_update(island->box);
+	}
+	journal.reset(checkpoint);
+
+	int count=0;
+	const TerrainJournal::Entry* entries=source.get_entries(checkpoint.position,count);
+	replay(entries,std::min<int>(count,position-checkpoint.position));
+	return true;
+}
@@ -3,6 +3,7 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <atomic>
 
 #include <SFML/Graphics.hpp>
 
@@ -10,18 +11,119 @@
 #include "Utils.h"
 #include "Quad.h"
 #include "SimpleList.h"
+#include "ToroidalGrid.h"
+#include "TerrainWorldFile.h"
+#include "TerrainJournal.h"
 #include "TerrainLoader.h"
 
-class TerrainIslandPoint {
+//row-major 1-bit grid, every row starts on a new 64-bit word
+class BitGrid {
 public:
-	//sf::Vector2f pos;
-	//float size;
-	bool active;
-	float health;
+	int w;
+	int h;
+	int stride;	//words per row
+	uint64_t* words;
+	bool owned;	//false for attached storage
 
-	TerrainIslandPoint() {
-		active=false;
-		health=0;
+	BitGrid() {
+		w=h=stride=0;
+		words=NULL;
+		owned=true;
+	}
+	~BitGrid() {
+		release();
+	}
+	void release() {
+		if(owned) {
+			delete[] words;
+		}
+		words=NULL;
+		owned=true;
+	}
+	void create(int _w,int _h) {
+		release();
+		w=_w;
+		h=_h;
+		stride=(w+63)/64;
+		words=new uint64_t[stride*h];
+		memset(words,0,stride*h*sizeof(uint64_t));
+	}
+	//uses stride*h words from elsewhere, which must outlive the grid
+	void attach(int _w,int _h,uint64_t* _words) {
+		release();
+		w=_w;
+		h=_h;
+		stride=(w+63)/64;
+		words=_words;
+		owned=false;
+	}
+	void swap(BitGrid& g) {
+		std::swap(w,g.w);
+		std::swap(h,g.h);
+		std::swap(stride,g.stride);
+		std::swap(words,g.words);
+		std::swap(owned,g.owned);
+	}
+	bool valid() const {
+		return (words!=NULL);
+	}
+	bool get(int x,int y) const {
+		return (words[y*stride+(x>>6)]>>(x&63))&1;
+	}
+	void set(int x,int y,bool value) {
+		uint64_t bit=(uint64_t)1<<(x&63);
+		if(value) {
+			words[y*stride+(x>>6)]|=bit;
+		}
+		else {
+			words[y*stride+(x>>6)]&=~bit;
+		}
+	}
+
+	//rects are half-open [x1,x2)x[y1,y2) and must lie inside the grid
+	bool any(int x1,int y1,int x2,int y2) const {
+		if(x1>=x2) return false;
+		for(int y=y1;y<y2;y++) {
+			const uint64_t* row=words+y*stride;
+			for(int wi=(x1>>6);wi<=((x2-1)>>6);wi++) {
+				uint64_t mask=Utils::bit_range64(std::max(x1-wi*64,0),std::min(x2-wi*64,64));
+				if(row[wi]&mask) return true;
+			}
+		}
+		return false;
+	}
+	int count(int x1,int y1,int x2,int y2) const {
+		if(x1>=x2) return 0;
+		int n=0;
+		for(int y=y1;y<y2;y++) {
+			const uint64_t* row=words+y*stride;
+			for(int wi=(x1>>6);wi<=((x2-1)>>6);wi++) {
+				uint64_t mask=Utils::bit_range64(std::max(x1-wi*64,0),std::min(x2-wi*64,64));
+				n+=Utils::popcount64(row[wi]&mask);
+			}
+		}
+		return n;
+	}
+	//count and coordinate sums of set cells in the rect
+	int sum(int x1,int y1,int x2,int y2,sf::Vector2f& out_sum) const {
+		out_sum=sf::Vector2f(0,0);
+		if(x1>=x2) return 0;
+		int n=0;
+		for(int y=y1;y<y2;y++) {
+			const uint64_t* row=words+y*stride;
+			int row_n=0;
+			for(int wi=(x1>>6);wi<=((x2-1)>>6);wi++) {
+				uint64_t bits=row[wi]&Utils::bit_range64(std::max(x1-wi*64,0),std::min(x2-wi*64,64));
+				row_n+=Utils::popcount64(bits);
+				while(bits) {
+					out_sum.x+=wi*64+Utils::ctz64(bits);
+					bits&=bits-1;
+				}
+			}
+			out_sum.y+=(float)row_n*y;
+			n+=row_n;
+		}
+		return n;
 	}
 };
 
@@ -176,10 +278,12 @@ public:
 	unsigned int data_size;
 	sf::Uint8* data;
 	sf::Vector2u size;
+	unsigned int channels;	//bytes per pixel
 
 	ImageData() {
 		data=NULL;
 		data_size=0;
+		channels=4;
 	}
 	~ImageData() {
 		delete[] data;
@@ -194,185 +298,200 @@ public:
 		delete[] data;
 
 		size=image->getSize();
+		channels=4;
 		data_size=size.x*size.y*4;
 		data=new sf::Uint8[data_size];
 		memcpy(data,image->getPixelsPtr(),data_size);
 	}
-	void create(int width,int height) {
+	void create(int width,int height,int _channels=4) {
 		delete[] data;
 		size=sf::Vector2u(width,height);
-		data_size=size.x*size.y*4;
+		channels=_channels;
+		data_size=size.x*size.y*channels;
 		data=new sf::Uint8[data_size];
 		memset(data,0,data_size);
 	}
+	void swap(ImageData& d) {
+		std::swap(data_size,d.data_size);
+		std::swap(data,d.data);
+		std::swap(size,d.size);
+		std::swap(channels,d.channels);
+	}
 };
 
-//simple static quadtree
-template<class T>
-class Octree {
+//recycles island textures and pixel buffers, sizes are rounded up to size classes
+//borrowed objects may be larger than asked for, callers use the top-left part
+//main thread only
+class TerrainPool {
 public:
-	std::vector<T> items;
-	SimpleList<T> ret_list;
-	Octree<T>* children[4];
-	Quad quad;
-	int max_depth;
-
-	Quad quad_for_child(int i) {
-		/*
-		0 1
-		2 3
-		*/
-		sf::Vector2f center=(quad.p1+quad.p2)*0.5f;
-		if(i==0) {
-			return Quad(quad.p1,center);
-		}
-		else if(i==1) {
-			return Quad(sf::Vector2f(center.x,quad.p1.y),sf::Vector2f(quad.p2.x,center.y));
-		}
-		else if(i==2) {
-			return Quad(sf::Vector2f(quad.p1.x,center.y),sf::Vector2f(center.x,quad.p2.y));
-		}
-		else {
-			return Quad(center,quad.p2);
+	class Stats {
+	public:
+		int hits;
+		int misses;
+		std::size_t resident_bytes;	//pooled and borrowed
+		std::size_t free_bytes;		//pooled only
+
+		Stats() {
+			hits=misses=0;
+			resident_bytes=free_bytes=0;
 		}
-	}
+	};
 
-	static void list_put_unique(SimpleList<T>& list,T item) {
-		for(int i=0;i<list.size();i++) {
-			if(list[i]==item) {
-				return;
-			}
-		}
-		list.push_back(item);
-	}
+private:
+	class FreeTexture {
+	public:
+		sf::Vector2u size;
+		int channels;
+		sf::Texture* texture;
+		uint64_t release_tick;
+	};
+	class FreePixels {
+	public:
+		sf::Vector2u size;
+		int channels;
+		ImageData* pixels;
+		uint64_t release_tick;
+	};
+
+	int class_step;
+	std::size_t max_free_bytes;
+	uint64_t tick;	//counts puts, orders free objects across both lists
+	std::vector<FreeTexture> free_textures;	//oldest first
+	std::vector<FreePixels> free_pixels;	//oldest first
+	Stats stats;
+
+	sf::Vector2u size_class(int width,int height) const;
+	void trim();
 
 public:
-	Octree() {
-		for(int i=0;i<4;i++) {
-			children[i]=NULL;
-		}
-		reset(Quad(sf::Vector2f(0,0),sf::Vector2f(0,0)),0);
-	}
-	~Octree() {
-		for(int i=0;i<4;i++) {
-			delete(children[i]);
-		}
-	}
-	void reset(const Quad& _quad,int _max_depth) {
-		for(int i=0;i<4;i++) {
-			delete(children[i]);
-			children[i]=NULL;
-		}
-		quad=_quad;
-		max_depth=_max_depth;
-	}
-	void put(const Quad& item_quad,const T& item) {
-		if(!item_quad.intersects(quad)) {
-			printf("WARN: this trunk does not contain item quad\n");
-			return;
-		}
+	TerrainPool(int _class_step=256,std::size_t _max_free_bytes=128*1024*1024);
+	~TerrainPool();
 
-		if(max_depth<0) {
-			printf("BUG: max_depth %d\n",max_depth);
-			return;
-		}
+	//channels 1 is a single byte GL_ALPHA8 texture, 4 is RGBA
+	sf::Texture* get_texture(int width,int height,int channels=4);
+	void put_texture(sf::Texture* texture,int channels=4);
+	//swaps a cleared buffer into out
+	void get_pixels(int width,int height,ImageData& out,int channels=4);
+	//takes the buffer, data is left empty
+	void put_pixels(ImageData& data);
 
-		if(max_depth==0) {
-			items.push_back(item);
-			return;
-		}
-		for(int i=0;i<4;i++) {
-			if(!children[i]) {
-				Quad child_quad=quad_for_child(i);
-				if(child_quad.intersects(item_quad)) {
-					children[i]=new Octree<T>();
-					children[i]->reset(child_quad,max_depth-1);
-					children[i]->put(item_quad,item);
-				}
-			}
-			else {
-				if(children[i]->quad.intersects(item_quad)) {
-					children[i]->put(item_quad,item);
-				}
-			}
-		}
+	const Stats& get_stats() const {
+		return stats;
 	}
+};
 
-	void query_list(const Quad& q,SimpleList<T>& _ret) {
-		if(!q.intersects(quad)) {
-			return;
-		}
-		for(const T& item : items) {
-			list_put_unique(_ret,item);
-		}
-		for(int i=0;i<4;i++) {
-			if(children[i]) {
-				children[i]->query_list(q,_ret);
-			}
-		}
-	}
-	SimpleList<T>& query(const Quad& q) {
-		ret_list.clear();
-		query_list(q,ret_list);
-		return ret_list;
+class Terrain;
+
+//pixels and texture of one load_chunks cell, drawn as a child of the island
+class TerrainTile {
+public:
+	Node node;
+	ImageData pixels;		//load_chunk_size squared, tile space
+	sf::Texture* texture;
+	std::vector<sf::IntRect> texture_updates;	//tile space, merged dirty rects waiting for upload
+
+	TerrainTile() {
+		texture=NULL;
 	}
+};
 
-	void query_list(const sf::Vector2f& point,SimpleList<T>& _ret) {
-		if(!quad.contains(point)) {
-			return;
-		}
-		for(const T& item : items) {
-			list_put_unique(_ret,item);
-		}
-		for(int i=0;i<4;i++) {
-			if(children[i]) {
-				children[i]->query_list(point,_ret);
-			}
-		}
+//island pixels addressed in island space, pixel (x,y) is data[((y-origin.y)*stride+x-origin.x)*channels]
+//4 channels is shaded RGBA with coverage in alpha
+//1 channel is compact, 0 empty, 1..255 covered and lit, material is applied by the tile shader
+class TerrainPixelView {
+public:
+	sf::Uint8* data;
+	int stride;
+	sf::Vector2i origin;
+	int channels;
+
+	TerrainPixelView(sf::Uint8* _data,int _stride,const sf::Vector2i& _origin,int _channels) {
+		data=_data;
+		stride=_stride;
+		origin=_origin;
+		channels=_channels;
+	}
+	sf::Uint8* at(int x,int y) const {
+		return data+((y-origin.y)*stride+x-origin.x)*channels;
 	}
-	SimpleList<T>& query(const sf::Vector2f& point) {
-		ret_list.clear();
-		query_list(point,ret_list);
-		return ret_list;
+	//offset of the coverage byte in a pixel
+	int coverage() const {
+		return channels-1;
 	}
 };
 
-
 class TerrainIsland : public Node {
 
 	ImageData terrain_texture;
-	ImageData result;
-	ImageData result_temp;
 
 	static ImageDataFloat* dist_map;
 	static ImageDataFloat* noise_map;
 
-	sf::Texture* gpu_texture;
-	//sf::Sprite sprite;
-
 	int w;
 	int h;
-	TerrainIslandPoint *map;
+	BitGrid cells;		//active cells
+	float* health;		//per cell, allocated on first damage
+
+	float& cell_health(int index);
 
 	int load_chunk_size;
-	ChunkGrid<bool> load_chunks;
+	ChunkGrid<bool> load_chunks;	//true where the tile is resident
+	std::vector<TerrainTile*> tiles;	//per load chunk, NULL unless resident
 	bool loaded;
+	bool cached;	//unloaded with pixels and texture kept
+	std::vector<sf::IntRect> cache_dirty;	//damage while cached, under pending_mutex
 
 	sf::Mutex load_mutex;
+	std::vector<float> noise_row;	//raster_area scratch, under load_mutex
 
-	sf::Mutex texture_mutex;
-	std::vector<sf::IntRect> texture_updates;
+	sf::Mutex texture_mutex;	//tile texture_updates
+
+	//pending update_area rects per priority (damage, visible), one loader task each drains them
+	std::atomic<uint32_t> load_generation;
+	sf::Mutex pending_mutex;
+	std::vector<sf::IntRect> pending_rects[2];
+	bool pending_queued[2];
+
+	void queue_update(const sf::IntRect& rect,TerrainLoaderTask::Priority priority);
 
 	sf::Vector2i noise_offset;
+	uint32_t seed;	//cell map noise, from world seed and island index
+
+	std::atomic<bool> generated;
+	sf::Mutex generate_mutex;
 
 	float terrain_health;
 
-	float image_get_light(const ImageData& data,int px,int py,int radius);
+	//shading kernel, light_radius.y>0 and light_weight.y lit from above as well
+	sf::Vector2i light_radius;
+	sf::Vector2f light_weight;
+	float light_limit;	//light is clamped to 1+-light_limit
+
+	//coverage into the alpha of view, then shading of covered pixels, view must hold the rect
+	void raster_area(const TerrainPixelView& view,int px1,int py1,int px2,int py2);
+	//view must also hold the rect grown by light_radius, clipped to the island
+	void shade_area(const TerrainPixelView& view,int px1,int py1,int px2,int py2);
+	//rasterized and shaded rect in scratch, under load_mutex
+	TerrainPixelView raster_scratch(int px1,int py1,int px2,int py2,int channels,std::vector<sf::Uint8>& scratch);
+	//rect in island space, clipped to the tile
+	void update_tile(TerrainTile* tile,int tile_x,int tile_y,const sf::IntRect& rect);
 
 	//rect is in cell coordinate system
 	void update_area_cell(sf::IntRect rect);
 
-	void update_texture(const sf::IntRect& rect);
+	void update_texture(TerrainTile* tile,const sf::IntRect& rect);
+
+	void tile_alloc(int index);
+	void tile_free(int index);
+	void init_pixel_format();
+
+	//gpu raster path, the cell map as a texture drawn by raster_shader instead of tiles
+	sf::Texture* cell_texture;	//w*h, 255 for active cells, NULL unless loaded or cached
+	Node cell_node;
+	sf::IntRect cell_updates;	//cells waiting for upload, main thread only
+	void cell_texture_alloc();
+	void cell_texture_free();
+	void update_cell_texture(const sf::IntRect& rect);
 
 public:
 
@@ -392,25 +511,111 @@ public:
 	int cell_size;
 	uint32_t version_id;	//will get incremented every time the island is changed (by damage_area)
 	static TerrainLoader* loader;
+	static TerrainPool* pool;
+
+	//one byte tiles expanded by shader/terrain.frag, RGBA tiles without shaders or when turned off
+	//read on the first island load, changing it later has no effect
+	static bool compact_pixels;
+	static int pixel_channels;		//tile format in use, 0 until the first load
+	static sf::Shader* compact_shader;
+
+	//cell map and noise_map uploaded as textures, shader/terrain_raster.frag rasterizes and lights at draw time
+	//damage then only uploads the changed cells, tiles are used without shaders or when turned off
+	//off by default, the shader redoes the lighting kernel for every pixel on every frame
+	//read on the first island load as well
+	static bool gpu_raster;
+	static sf::Shader* raster_shader;	//NULL unless the gpu path is in use
+	static sf::Texture* noise_texture;	//noise_map+0.5 as 24 bit fixed point in RGB, repeated
+	//noise_texture contents, RGBA, returns the size
+	static sf::Vector2u noise_texels(std::vector<sf::Uint8>& out);
+	//what RGBA tiles hold for rect, clipped to the island, to check the gpu path against
+	bool raster_reference(const sf::IntRect& rect,ImageData& out);
 
 	//rect is in texture coordinate system
 	void update_area(sf::IntRect rect);
+	//runs rects queued with priority, called from loader
+	void update_pending(TerrainLoaderTask::Priority priority);
+
+	//cancellation token, queued loader work is dropped once the generation moves on
+	uint32_t get_load_generation() const {
+		return load_generation;
+	}
+	void cancel_tasks();
 
 	Quad box;
 	sf::Vector2f box_size;
 	sf::Vector2f offset;
 
-	TerrainIsland(Quad _box);
-	void update_visual(const sf::FloatRect& rect);
+	TerrainIsland(Quad _box,uint32_t _seed);
+	int index;	//in Terrain's island list, names the island in the damage journal
+	float unload_timer;	//seconds spent outside Terrain's keep area
+	float cache_age;	//seconds since cached
+
+	bool is_cached() const {
+		return cached;
+	}
+	//frees the tiles of a cached island
+	void evict();
+	std::size_t get_resident_bytes() const;
+
+	//rect is the prefetch area in island space, tiles outside keep_rect are freed
+	//upload_budget is bytes of texture upload left this frame, decreased by what the island uploads
+	void update_visual(const sf::FloatRect& rect,const sf::FloatRect& keep_rect,int& upload_budget);
 
 	void init();
+	void generate_cells(BitGrid& grid) const;
+	//runs init once and adds the island to terrain occupancy, thread safe
+	void generate(Terrain* terrain);
+	bool is_generated() const {
+		return generated;
+	}
+	//takes baked cells instead of generating, false if already generated or sizes differ
+	bool attach_cells(int _w,int _h,uint64_t* words);
+	const BitGrid& get_cells() const {
+		return cells;
+	}
+	uint32_t get_seed() const {
+		return seed;
+	}
+	sf::Vector2i get_cell_count() const {
+		return sf::Vector2i(w,h);
+	}
+	sf::Vector2i get_noise_offset() const {
+		return noise_offset;
+	}
+	sf::Vector2f get_light_weight() const {
+		return light_weight;
+	}
+	float get_light_limit() const {
+		return light_limit;
+	}
+	std::atomic<bool> generate_queued;
+
 	void load();
 	void unload();
-	void damage_area(const sf::FloatRect& rect,float damage);
-	void damage_chunk(int index,float damage);
+	//return true when some cell got destroyed
+	bool damage_area(const sf::FloatRect& rect,float damage);
+	bool damage_chunk(int index,float damage);
+	bool damage_cells(const sf::IntRect& range,float damage);
+	//cells touched by rect in island space, clipped to the island
+	sf::IntRect get_cell_range(const sf::FloatRect& rect) const;
+
+	bool is_damaged() const {
+		return (health!=NULL);
+	}
+	void get_state(TerrainJournal::IslandState& out) const;
+	//state NULL restores the island as generated
+	void set_state(const TerrainJournal::IslandState* state);
+	sf::Vector2f get_chunk_pos(int index) const;	//world space center of chunk
 	bool check_collision(const sf::FloatRect& rect);
 	bool check_collision(const sf::FloatRect& rect,sf::Vector2f& normal);
 	bool check_collision(const sf::Vector2f& pos,ChunkAddress& chunk);
+	//same without the generated check, for the generating thread before generated is set
+	bool check_cells(const sf::Vector2f& pos,ChunkAddress& chunk);
+	bool check_cells(const sf::FloatRect& rect);
+	//first active cell along p1->p2 (island space) between t_min and t_max, out_t is parametric
+	bool query_ray(const sf::Vector2f& p1,const sf::Vector2f& p2,float t_min,float t_max,
+			float& out_t,ChunkAddress& chunk);
 
 	void generate_icon_texture(sf::Texture* texture);	//texture needs to be proper size!
 	Texture generate_icon_texture();
@@ -419,15 +624,71 @@ public:
 class Terrain : public Node {
 	std::vector<TerrainIsland*> islands;
 
-	Octree<TerrainIsland*> octree;
+	ToroidalGrid<TerrainIsland*> island_grid;
+	ToroidalGrid<TerrainIsland*>::Query island_query;	//main thread
+	SimpleList<TerrainIsland*> island_list;
 	SimpleList<TerrainIsland*> loaded_islands;
+	std::vector<TerrainIsland*> cached_islands;
+	std::vector<std::size_t> cached_bytes;	//resident bytes of cached_islands[i] when inserted
+	std::size_t cache_bytes;
+
+	//islands are generated lazily, on prefetch or on the first query touching them
+	BitGrid generated_regions;	//island layout cells whose islands are all generated
+	sf::Vector2f region_size;
+	sf::Mutex region_mutex;
+
+	void generate_area(const Quad& quad);
+
+	void cache_insert(TerrainIsland* island);
+	void cache_remove(TerrainIsland* island);
+	void cache_trim();
+
+	TerrainJournal journal;
+	//records entry and applies it, returns true when cells were destroyed
+	bool damage_entry(const TerrainJournal::Entry& entry);
+	bool damage_island(TerrainIsland* island,const sf::IntRect& range,float damage);
+
+	TerrainWorldFile world_file;	//backs island cells and occupancy once opened, never closed
+
+	//background bake after a world file miss, islands hand over their cells as they generate
+	std::atomic<bool> baking;
+	std::atomic<int> bake_remaining;	//islands not handed over yet
+	std::string bake_path;
+	std::vector<std::vector<uint64_t> > bake_cells;	//cells as generated, per island index
+	BitGrid bake_occupancy;		//occupancy of the generated cells, under occupancy_mutex
+	//writes the bake out, called by whichever thread hands over the last island
+	void bake_world_file();
+
+	//world occupancy at island cell resolution, cell is active when any island cell it overlaps is active
+	//conservative, exact point tests still go to the island
+	BitGrid occupancy;
+	float occupancy_cell_size;
+	sf::Mutex occupancy_mutex;	//loader and ParallelFor threads write while the game reads
 
 	void add_island(TerrainIsland* island);
 
+	//ranges are in occupancy cells, any size and sign, wrapped around the field
+	bool occupancy_any(int x1,int y1,int x2,int y2);
+	int occupancy_sum(int x1,int y1,int x2,int y2,sf::Vector2f& out_sum);
+	//recomputes occupancy cells covered by quad from islands
+	void occupancy_update(const Quad& quad);
+
 	TerrainIsland* get_island_at_point(const sf::Vector2f& pos);
 
 public:
 
+	class Ray {
+	public:
+		sf::Vector2f start;
+		sf::Vector2f end;
+
+		Ray() {}
+		Ray(const sf::Vector2f& _start,const sf::Vector2f& _end) {
+			start=_start;
+			end=_end;
+		}
+	};
+
 	class RayQuery {
 	public:
 
@@ -442,19 +703,59 @@ public:
 	};
 
 	sf::Vector2f field_size;
-
-	Terrain();
-	void update_visual(const sf::FloatRect& rect);
+	int upload_budget;	//bytes of island texture uploads per frame
+
+	float prefetch_margin;	//islands around the camera are loaded and rasterized this far out
+	float prefetch_time;	//seconds of velocity added to the prefetch area
+	float unload_margin;	//loaded islands are kept while this close to the camera
+	float unload_grace;		//seconds outside unload_margin before unloading
+	std::size_t cache_budget;	//bytes of unloaded islands kept rasterized
+
+	uint32_t world_seed;	//island layout and cell maps depend only on this
+
+	Terrain(uint32_t _world_seed=1);
+	//generates every island now, in parallel, result doesn't depend on thread count
+	void generate_all(int thread_count=-1);
+	//maps the baked world at path and returns true
+	//on a miss islands keep generating lazily, the loader generates the rest at low priority and the world is baked to path once all are in
+	//call before the terrain is used
+	bool open_world_file(const std::string& path);
+	bool is_baking() const {
+		return baking;
+	}
+	//rect is the camera, velocity its movement per second
+	void update_visual(const sf::FloatRect& rect,const sf::Vector2f& velocity,float dt);
 	void damage_area(const sf::FloatRect& rect,float damage);
 	bool check_collision(const sf::FloatRect& rect);
 	bool check_collision(const sf::FloatRect& rect,sf::Vector2f& normal);
 	bool check_collision(sf::Vector2f pos,TerrainIsland::ChunkAddress& chunk);
 	RayQuery query_ray(const sf::Vector2f& start,const sf::Vector2f& end);
+	void query_rays(const std::vector<Ray>& rays,std::vector<RayQuery>& out);
+	//ray against islands from list, which must cover the ray
+	RayQuery query_ray(const Ray& ray,const SimpleList<TerrainIsland*>& list);
 	bool island_intersects(TerrainIsland* island,const Quad& quad);
 
 	void damage_ray(const RayQuery& ray,float damage);
 
-	SimpleList<TerrainIsland*>& list_islands(const Quad& _quad);
+	const TerrainJournal& get_journal() const {
+		return journal;
+	}
+	//folds the journal into a checkpoint of every damaged island
+	void journal_checkpoint();
+	//applies and records entries from another journal, to fast forward or follow another client
+	void replay(const TerrainJournal::Entry* entries,int count);
+	//puts the world in the state of source at position, false if position isn't in it, the world differs or a checkpoint state doesn't fit its island
+	bool restore(const TerrainJournal& source,uint32_t position);
+
+	//ORs freshly initialized island into occupancy, called from loader
+	void occupancy_add(TerrainIsland* island);
+	//queues island generation on the loader unless it's done or queued
+	void request_generation(TerrainIsland* island,TerrainLoaderTask::Priority priority);
+
+	//islands touching quad, handles wrapping
+	//returned list is shared, use the second form off the main thread or while holding a previous result
+	SimpleList<TerrainIsland*>& list_islands(const Quad& quad);
+	void list_islands(const Quad& quad,ToroidalGrid<TerrainIsland*>::Query& query,SimpleList<TerrainIsland*>& out) const;
 };
 
 #endif
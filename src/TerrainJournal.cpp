@@ -0,0 +1,146 @@
+#include <stdio.h>
+
+#include "TerrainJournal.h"
+
+namespace {
+
+class FileHeader {
+public:
+	uint32_t magic;
+	uint32_t version;
+	uint32_t world_seed;
+	uint32_t position;
+	uint32_t island_count;
+	uint32_t entry_count;
+};
+class FileIsland {
+public:
+	uint32_t island;
+	uint32_t word_count;
+	uint32_t health_count;
+};
+
+template<class T>
+bool write_array(FILE* f,const std::vector<T>& v) {
+	return v.empty() || fwrite(&v[0],sizeof(T),v.size(),f)==v.size();
+}
+//count comes from the file, it has to fit in the remaining bytes before anything is allocated
+template<class T>
+bool read_array(FILE* f,std::vector<T>& v,uint32_t count,uint64_t& remaining) {
+	if((uint64_t)count*sizeof(T)>remaining) {
+		return false;
+	}
+	remaining-=(uint64_t)count*sizeof(T);
+	v.resize(count);
+	return v.empty() || fread(&v[0],sizeof(T),v.size(),f)==v.size();
+}
+
+}
+
+const TerrainJournal::IslandState* TerrainJournal::Checkpoint::find(uint32_t island) const {
+	for(int i=0;i<(int)islands.size();i++) {
+		if(islands[i].island==island) {
+			return &islands[i];
+		}
+	}
+	return NULL;
+}
+
+void TerrainJournal::compact(Checkpoint& state) {
+	state.position=get_position();
+	checkpoint.islands.swap(state.islands);
+	checkpoint.position=state.position;
+	entries.clear();
+}
+void TerrainJournal::reset(const Checkpoint& start) {
+	checkpoint=start;
+	entries.clear();
+}
+
+const TerrainJournal::Entry* TerrainJournal::get_entries(uint32_t position,int& count) const {
+	if(position<checkpoint.position || position>=get_position()) {
+		count=0;
+		return NULL;
+	}
+	int first=position-checkpoint.position;
+	count=entries.size()-first;
+	return &entries[first];
+}
+
+bool TerrainJournal::save(const std::string& path) const {
+	FILE* f=fopen(path.c_str(),"wb");
+	if(!f) {
+		printf("can't write journal %s\n",path.c_str());
+		return false;
+	}
+	FileHeader header;
+	header.magic=MAGIC;
+	header.version=VERSION;
+	header.world_seed=world_seed;
+	header.position=checkpoint.position;
+	header.island_count=checkpoint.islands.size();
+	header.entry_count=entries.size();
+
+	bool ok=(fwrite(&header,sizeof(header),1,f)==1);
+	for(int i=0;i<(int)checkpoint.islands.size() && ok;i++) {
+		const IslandState& state=checkpoint.islands[i];
+		FileIsland fi;
+		fi.island=state.island;
+		fi.word_count=state.cells.size();
+		fi.health_count=state.health.size();
+		ok=(fwrite(&fi,sizeof(fi),1,f)==1);
+		ok=ok && write_array(f,state.cells) && write_array(f,state.health);
+	}
+	ok=ok && write_array(f,entries);
+	ok=(fclose(f)==0) && ok;
+
+	if(!ok) {
+		printf("can't write journal %s\n",path.c_str());
+	}
+	return ok;
+}
+bool TerrainJournal::load(const std::string& path) {
+	FILE* f=fopen(path.c_str(),"rb");
+	if(!f) {
+		return false;
+	}
+	fseek(f,0,SEEK_END);
+	long file_size=ftell(f);
+	fseek(f,0,SEEK_SET);
+
+	FileHeader header;
+	bool ok=(file_size>=(long)sizeof(header) && fread(&header,sizeof(header),1,f)==1 &&
+			header.magic==MAGIC && header.version==VERSION);
+	uint64_t remaining=(ok ? file_size-sizeof(header) : 0);
+
+	Checkpoint loaded;
+	std::vector<Entry> loaded_entries;
+	if(ok) {
+		ok=((uint64_t)header.island_count*sizeof(FileIsland)<=remaining);
+	}
+	if(ok) {
+		loaded.position=header.position;
+		loaded.islands.resize(header.island_count);
+		for(int i=0;i<(int)header.island_count && ok;i++) {
+			IslandState& state=loaded.islands[i];
+			FileIsland fi;
+			ok=(remaining>=sizeof(fi) && fread(&fi,sizeof(fi),1,f)==1);
+			remaining-=(ok ? sizeof(fi) : 0);
+			state.island=fi.island;
+			ok=ok && read_array(f,state.cells,fi.word_count,remaining) && read_array(f,state.health,fi.health_count,remaining);
+		}
+		ok=ok && read_array(f,loaded_entries,header.entry_count,remaining);
+		ok=ok && (remaining==0);
+	}
+	fclose(f);
+
+	if(!ok) {
+		printf("can't read journal %s\n",path.c_str());
+		return false;
+	}
+	world_seed=header.world_seed;
+	checkpoint.islands.swap(loaded.islands);
+	checkpoint.position=loaded.position;
+	entries.swap(loaded_entries);
+	return true;
+}
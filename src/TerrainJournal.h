@@ -0,0 +1,86 @@
+#ifndef _BGA_TERRAINJOURNAL_H_
+#define _BGA_TERRAINJOURNAL_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//append-only log of terrain damage since world generation
+//entries are in island cells so replaying them gives the exact same cells and health
+//old entries are periodically folded into a checkpoint holding the state of every damaged island
+class TerrainJournal {
+public:
+
+	static const uint32_t MAGIC=0x4a414742;		//"BGAJ"
+	static const uint32_t VERSION=1;
+
+	//damage to cells [x1,x2)x[y1,y2) of one island
+	class Entry {
+	public:
+		uint16_t island;
+		uint16_t x1;
+		uint16_t y1;
+		uint16_t x2;
+		uint16_t y2;
+		uint16_t pad;
+		float amount;
+	};
+
+	class IslandState {
+	public:
+		uint32_t island;
+		std::vector<uint64_t> cells;	//BitGrid words
+		std::vector<float> health;		//empty while undamaged
+	};
+
+	class Checkpoint {
+	public:
+		uint32_t position;	//journal entries folded in
+		std::vector<IslandState> islands;
+
+		Checkpoint() {
+			position=0;
+		}
+		const IslandState* find(uint32_t island) const;
+	};
+
+private:
+	Checkpoint checkpoint;
+	std::vector<Entry> entries;		//after checkpoint
+
+public:
+	uint32_t world_seed;	//of the world the entries apply to
+	int compact_entries;	//entries kept before the owner should checkpoint
+
+	TerrainJournal() {
+		world_seed=0;
+		compact_entries=4096;
+	}
+
+	void append(const Entry& entry) {
+		entries.push_back(entry);
+	}
+	bool needs_compaction() const {
+		return ((int)entries.size()>=compact_entries);
+	}
+	//replaces checkpoint and drops entries, state must be the world with every entry applied
+	void compact(Checkpoint& state);
+	//starts over from start, with no entries after it
+	void reset(const Checkpoint& start);
+
+	//absolute entry count since world generation
+	uint32_t get_position() const {
+		return checkpoint.position+entries.size();
+	}
+	const Checkpoint& get_checkpoint() const {
+		return checkpoint;
+	}
+	//entries from position on, position must not be before the checkpoint
+	const Entry* get_entries(uint32_t position,int& count) const;
+
+	bool save(const std::string& path) const;
+	//false on a malformed file, state sizes are only checked against the islands by Terrain::restore
+	bool load(const std::string& path);
+};
+
+#endif
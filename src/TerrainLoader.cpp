@@ -1,22 +1,102 @@
+#include <algorithm>
+#include <cmath>
+
 #include "TerrainLoader.h"
 #include "Terrain.h"
 
+TerrainLoader::TerrainLoader(int thread_count) {
+	next_order=0;
+	quit=false;
+	focus_changed=false;
+
+	if(thread_count<0) {
+		thread_count=std::thread::hardware_concurrency()-1;
+		thread_count=std::max(1,std::min(4,thread_count));
+	}
+	for(int i=0;i<thread_count;i++) {
+		threads.push_back(std::thread(&TerrainLoader::entry,this));
+	}
+}
+TerrainLoader::~TerrainLoader() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit=true;
+	}
+	cond.notify_all();
+	for(std::thread& t : threads) {
+		t.join();
+	}
+	for(QueueItem& item : queue) {
+		delete(item.task);
+	}
+}
+
+float TerrainLoader::focus_distance(const sf::Vector2f& pos) const {
+	float dx=std::fabs(pos.x-focus.x);
+	float dy=std::fabs(pos.y-focus.y);
+	if(wrap_size.x>0) {
+		dx=std::fmod(dx,wrap_size.x);
+		dx=std::min(dx,wrap_size.x-dx);
+	}
+	if(wrap_size.y>0) {
+		dy=std::fmod(dy,wrap_size.y);
+		dy=std::min(dy,wrap_size.y-dy);
+	}
+	return dx*dx+dy*dy;
+}
+//heap comparator, true when a runs after b
+bool TerrainLoader::queue_less(const QueueItem& a,const QueueItem& b) {
+	if(a.task->priority!=b.task->priority) {
+		return (a.task->priority>b.task->priority);
+	}
+	if(a.distance!=b.distance) {
+		return (a.distance>b.distance);
+	}
+	return (a.order>b.order);
+}
+
+void TerrainLoader::add_task(TerrainLoaderTask *task) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		QueueItem item;
+		item.task=task;
+		item.distance=focus_distance(task->pos);
+		item.order=next_order++;
+		queue.push_back(item);
+		std::push_heap(queue.begin(),queue.end(),queue_less);
+	}
+	cond.notify_one();
+}
+void TerrainLoader::set_focus(const sf::Vector2f& pos,const sf::Vector2f& _wrap_size) {
+	std::lock_guard<std::mutex> lock(mutex);
+	focus=pos;
+	wrap_size=_wrap_size;
+	focus_changed=true;
+}
+
 void TerrainLoader::entry() {
+	std::unique_lock<std::mutex> lock(mutex);
 	while(true) {
-		mutex.lock();
-		if(tasks.size()==0) {
-			mutex.unlock();
-			sf::sleep(sf::milliseconds(10));
-			continue;
+		cond.wait(lock,[&]() { return quit || !queue.empty(); });
+		if(quit) {
+			return;
 		}
-		TerrainLoaderTask* task=tasks.front();
-		tasks.erase(tasks.begin());
-		mutex.unlock();
-
-		//printf("loader task..\n");
+		if(focus_changed) {
+			for(QueueItem& item : queue) {
+				item.distance=focus_distance(item.task->pos);
+			}
+			std::make_heap(queue.begin(),queue.end(),queue_less);
+			focus_changed=false;
+		}
+		std::pop_heap(queue.begin(),queue.end(),queue_less);
+		TerrainLoaderTask* task=queue.back().task;
+		queue.pop_back();
 
-		//task.island->update_area(task.update_rect);
-		task->execute();
+		lock.unlock();
+		if(!task->cancelled()) {
+			task->execute();
+		}
 		delete(task);
+		lock.lock();
 	}
 }
@@ -1,6 +1,12 @@
 #ifndef _TerrainIsland_H_
 #define _TerrainIsland_H_
 
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
 #include <SFML/Graphics.hpp>
 #include <SFML/System.hpp>
 
@@ -8,7 +14,24 @@ class TerrainIsland;
 
 class TerrainLoaderTask {
 public:
+	//lower runs first, damage refresh goes ahead of streaming so hits show up right away
+	enum Priority {
+		PRIORITY_DAMAGE=0,
+		PRIORITY_VISIBLE,
+		PRIORITY_INIT
+	};
+
+	Priority priority;
+	sf::Vector2f pos;	//world position, tasks of same priority closer to focus run first
+
+	TerrainLoaderTask() {
+		priority=PRIORITY_INIT;
+	}
 	virtual void execute()=0;
+	//checked when popped, cancelled tasks are dropped without running
+	virtual bool cancelled() {
+		return false;
+	}
 	virtual ~TerrainLoaderTask() {}
 };
 
@@ -28,23 +51,42 @@ public:
 
 class TerrainLoader {
 
-	sf::Thread thread;
-	sf::Mutex mutex;
-	std::vector<TerrainLoaderTask*> tasks;
+	class QueueItem {
+	public:
+		TerrainLoaderTask* task;
+		float distance;		//squared, to focus
+		uint64_t order;		//FIFO among equal keys
+	};
+
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::vector<QueueItem> queue;	//heap, best task at front
+	uint64_t next_order;
+	bool quit;
+
+	sf::Vector2f focus;
+	sf::Vector2f wrap_size;		//distances are toroidal when set
+	bool focus_changed;
+
+	float focus_distance(const sf::Vector2f& pos) const;
+	static bool queue_less(const QueueItem& a,const QueueItem& b);
 
 	void entry();
 
 public:
 
-	TerrainLoader() : thread(&TerrainLoader::entry,this) {
-		thread.launch();
-	}
-	void add_task(TerrainLoaderTask *task) {
-		mutex.lock();
-		tasks.push_back(task);
-		mutex.unlock();
-	}
+	//thread_count<0: picks from hardware threads, leaving room for the main thread
+	TerrainLoader(int thread_count=-1);
+	~TerrainLoader();
+
+	void add_task(TerrainLoaderTask *task);
+	//queued tasks get re-sorted by distance to pos on the next pop
+	void set_focus(const sf::Vector2f& pos,const sf::Vector2f& _wrap_size);
 
+	int get_thread_count() const {
+		return threads.size();
+	}
 };
 
 #endif
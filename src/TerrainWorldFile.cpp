@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#include <Windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+#include "TerrainWorldFile.h"
+
+namespace {
+
+uint64_t align8(uint64_t v) {
+	return (v+7)&~(uint64_t)7;
+}
+
+}
+
+TerrainWorldFile::TerrainWorldFile() {
+	data=NULL;
+	size=0;
+	mapped=false;
+}
+TerrainWorldFile::~TerrainWorldFile() {
+	close();
+}
+
+bool TerrainWorldFile::map_file(const std::string& path) {
+#ifdef _WIN32
+	HANDLE file=CreateFileA(path.c_str(),GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+	if(file==INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER file_size;
+	if(!GetFileSizeEx(file,&file_size) || file_size.QuadPart<(LONGLONG)sizeof(Header)) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping=CreateFileMappingA(file,NULL,PAGE_WRITECOPY,0,0,NULL);
+	CloseHandle(file);
+	if(!mapping) {
+		return false;
+	}
+	void* view=MapViewOfFile(mapping,FILE_MAP_COPY,0,0,0);
+	CloseHandle(mapping);	//view keeps the mapping alive
+	if(!view) {
+		return false;
+	}
+	data=(uint8_t*)view;
+	size=file_size.QuadPart;
+#else
+	int fd=::open(path.c_str(),O_RDONLY);
+	if(fd<0) {
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd,&st)!=0 || st.st_size<(off_t)sizeof(Header)) {
+		::close(fd);
+		return false;
+	}
+	void* view=mmap(NULL,st.st_size,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+	::close(fd);
+	if(view==MAP_FAILED) {
+		return false;
+	}
+	data=(uint8_t*)view;
+	size=st.st_size;
+#endif
+	mapped=true;
+	return true;
+}
+bool TerrainWorldFile::read_file(const std::string& path) {
+	FILE* f=fopen(path.c_str(),"rb");
+	if(!f) {
+		return false;
+	}
+	fseek(f,0,SEEK_END);
+	long file_size=ftell(f);
+	fseek(f,0,SEEK_SET);
+	if(file_size<(long)sizeof(Header)) {
+		fclose(f);
+		return false;
+	}
+	//word storage keeps the sections aligned
+	uint64_t* buffer=new uint64_t[(file_size+7)/8];
+	bool ok=(fread(buffer,1,file_size,f)==(size_t)file_size);
+	fclose(f);
+	if(!ok) {
+		delete[] buffer;
+		return false;
+	}
+	data=(uint8_t*)buffer;
+	size=file_size;
+	mapped=false;
+	return true;
+}
+bool TerrainWorldFile::validate() {
+	const Header& header=get_header();
+	if(header.magic!=MAGIC || header.version!=VERSION || header.size!=size) {
+		return false;
+	}
+	uint64_t table_end=sizeof(Header)+(uint64_t)header.island_count*sizeof(Island);
+	if(table_end>size) {
+		return false;
+	}
+	for(uint32_t i=0;i<header.island_count;i++) {
+		const Island& island=get_island(i);
+		if(island.w<=0 || island.h<=0 || island.stride!=(uint32_t)(island.w+63)/64 ||
+				(island.cells_offset&7) || island.cells_offset<table_end ||
+				island.cells_offset+(uint64_t)island.stride*island.h*8>size) {
+			return false;
+		}
+	}
+	if(header.occupancy_w<=0 || header.occupancy_h<=0 ||
+			header.occupancy_stride!=(uint32_t)(header.occupancy_w+63)/64 ||
+			(header.occupancy_offset&7) || header.occupancy_offset<table_end ||
+			header.occupancy_offset+(uint64_t)header.occupancy_stride*header.occupancy_h*8>size) {
+		return false;
+	}
+	return true;
+}
+
+bool TerrainWorldFile::open(const std::string& path) {
+	close();
+	if(!map_file(path) && !read_file(path)) {
+		return false;
+	}
+	if(!validate()) {
+		printf("world file %s is stale or malformed\n",path.c_str());
+		close();
+		return false;
+	}
+	return true;
+}
+void TerrainWorldFile::close() {
+	if(!data) {
+		return;
+	}
+	if(mapped) {
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+#else
+		munmap(data,size);
+#endif
+	}
+	else {
+		delete[] (uint64_t*)data;
+	}
+	data=NULL;
+	size=0;
+	mapped=false;
+}
+
+bool TerrainWorldFile::write(const std::string& path,Header header,std::vector<Island> islands,
+		const std::vector<const uint64_t*>& cells,const uint64_t* occupancy) {
+
+	//layout
+	uint64_t offset=align8(sizeof(Header)+islands.size()*sizeof(Island));
+	for(int i=0;i<(int)islands.size();i++) {
+		islands[i].cells_offset=offset;
+		offset=align8(offset+(uint64_t)islands[i].stride*islands[i].h*8);
+	}
+	header.magic=MAGIC;
+	header.version=VERSION;
+	header.island_count=islands.size();
+	header.pad=0;
+	header.occupancy_offset=offset;
+	header.size=offset+(uint64_t)header.occupancy_stride*header.occupancy_h*8;
+
+	//write to a temporary name so a crash never leaves a truncated file behind
+	std::string temp_path=path+".tmp";
+	FILE* f=fopen(temp_path.c_str(),"wb");
+	if(!f) {
+		printf("can't write world file %s\n",temp_path.c_str());
+		return false;
+	}
+	bool ok=(fwrite(&header,sizeof(Header),1,f)==1);
+	if(!islands.empty()) {
+		ok=ok && (fwrite(&islands[0],sizeof(Island),islands.size(),f)==islands.size());
+	}
+	static const uint8_t zero[8]={0};
+	uint64_t pos=sizeof(Header)+islands.size()*sizeof(Island);
+	for(int i=0;i<(int)islands.size() && ok;i++) {
+		ok=(fwrite(zero,1,islands[i].cells_offset-pos,f)==islands[i].cells_offset-pos);
+		uint64_t words=(uint64_t)islands[i].stride*islands[i].h;
+		ok=ok && (fwrite(cells[i],8,words,f)==words);
+		pos=islands[i].cells_offset+words*8;
+	}
+	if(ok) {
+		uint64_t words=(uint64_t)header.occupancy_stride*header.occupancy_h;
+		ok=(fwrite(zero,1,header.occupancy_offset-pos,f)==header.occupancy_offset-pos);
+		ok=ok && (fwrite(occupancy,8,words,f)==words);
+	}
+	ok=(fclose(f)==0) && ok;
+
+	if(!ok) {
+		printf("can't write world file %s\n",temp_path.c_str());
+		remove(temp_path.c_str());
+		return false;
+	}
+	remove(path.c_str());	//rename doesn't replace on windows
+	if(rename(temp_path.c_str(),path.c_str())!=0) {
+		printf("can't write world file %s\n",path.c_str());
+		remove(temp_path.c_str());
+		return false;
+	}
+	return true;
+}
+bool TerrainWorldFile::writable(const std::string& path) {
+	std::string temp_path=path+".tmp";
+	FILE* f=fopen(temp_path.c_str(),"wb");
+	if(!f) {
+		return false;
+	}
+	fclose(f);
+	remove(path.c_str());
+	if(rename(temp_path.c_str(),path.c_str())!=0) {
+		remove(temp_path.c_str());
+		return false;
+	}
+	remove(path.c_str());
+	return true;
+}
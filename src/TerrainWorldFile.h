@@ -0,0 +1,85 @@
+#ifndef _BGA_TERRAINWORLDFILE_H_
+#define _BGA_TERRAINWORLDFILE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//baked terrain for one world seed: header, island table, bit-packed cell maps and world occupancy
+//the file is mapped copy-on-write, damage can write into the cell maps without touching the file
+//all sections are 8 byte aligned, cell rows are uint64_t words exactly like BitGrid
+class TerrainWorldFile {
+public:
+
+	static const uint32_t MAGIC=0x57414742;		//"BGAW", also rejects files of other byte order
+	static const uint32_t VERSION=2;			//bump whenever generation output changes
+
+	class Header {
+	public:
+		uint32_t magic;
+		uint32_t version;
+		uint32_t world_seed;
+		uint32_t island_count;
+		float field_w;
+		float field_h;
+		int32_t occupancy_w;
+		int32_t occupancy_h;
+		uint32_t occupancy_stride;
+		uint32_t pad;
+		uint64_t occupancy_offset;
+		uint64_t size;		//whole file
+	};
+
+	class Island {
+	public:
+		float x1;
+		float y1;
+		float x2;
+		float y2;
+		uint32_t seed;
+		int32_t w;
+		int32_t h;
+		uint32_t stride;	//words per row
+		uint64_t cells_offset;
+	};
+
+private:
+	uint8_t* data;
+	uint64_t size;
+	bool mapped;	//false when read into memory
+
+	bool map_file(const std::string& path);
+	bool read_file(const std::string& path);
+	bool validate();
+
+public:
+	TerrainWorldFile();
+	~TerrainWorldFile();
+
+	//maps the file, falls back to reading it, false if missing or malformed
+	bool open(const std::string& path);
+	void close();
+	bool is_open() const {
+		return (data!=NULL);
+	}
+
+	const Header& get_header() const {
+		return *(const Header*)data;
+	}
+	const Island& get_island(int i) const {
+		return ((const Island*)(data+sizeof(Header)))[i];
+	}
+	//writable private copy, valid until close()
+	uint64_t* get_words(uint64_t offset) {
+		return (uint64_t*)(data+offset);
+	}
+
+	//header counts and island w/h/stride must be filled, offsets and size are set here
+	//cells[i] holds stride*h words of island i
+	static bool write(const std::string& path,Header header,std::vector<Island> islands,
+			const std::vector<const uint64_t*>& cells,const uint64_t* occupancy);
+	//true if write() could replace path, tries the same steps with an empty file and leaves nothing behind
+	static bool writable(const std::string& path);
+};
+
+#endif
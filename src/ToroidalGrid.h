@@ -0,0 +1,157 @@
+#ifndef _BGA_TOROIDALGRID_H_
+#define _BGA_TOROIDALGRID_H_
+
+#include <stdint.h>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <SFML/System/Vector2.hpp>
+
+#include "Quad.h"
+#include "SimpleList.h"
+
+//static bucket grid over a wrapping field
+//items are inserted once with bboxes inside the field, queries take any world quad and see every wrapped copy
+//queries don't modify the grid, de-duplication state lives in the caller's Query so threads can share it
+template<class T>
+class ToroidalGrid {
+
+	class Entry {
+	public:
+		Quad bbox;
+		T item;
+	};
+
+	sf::Vector2f field_size;
+	sf::Vector2f cell_size;		//divides field_size exactly
+	int cols;
+	int rows;
+
+	std::vector<Entry> entries;
+	std::vector<std::vector<int> > buckets;
+
+	static int floor_div(int a,int b) {
+		int q=a/b;
+		if(a%b!=0 && a<0) {
+			q--;
+		}
+		return q;
+	}
+
+public:
+
+	//per caller query state
+	class Query {
+		friend class ToroidalGrid<T>;
+		std::vector<uint32_t> stamps;
+		uint32_t epoch;
+	public:
+		Query() {
+			epoch=0;
+		}
+	};
+
+	ToroidalGrid() {
+		cols=rows=0;
+	}
+
+	void reset(const sf::Vector2f& _field_size,float _cell_size) {
+		field_size=_field_size;
+		cols=std::max(1,(int)std::floor(field_size.x/_cell_size+0.5f));
+		rows=std::max(1,(int)std::floor(field_size.y/_cell_size+0.5f));
+		cell_size=sf::Vector2f(field_size.x/cols,field_size.y/rows);
+
+		entries.clear();
+		buckets.clear();
+		buckets.resize(cols*rows);
+	}
+	int size() const {
+		return entries.size();
+	}
+
+	void insert(const Quad& bbox,const T& item) {
+		int index=entries.size();
+
+		Entry e;
+		e.bbox=bbox;
+		e.item=item;
+		entries.push_back(e);
+
+		int x1=std::max(0,(int)std::floor(bbox.p1.x/cell_size.x));
+		int y1=std::max(0,(int)std::floor(bbox.p1.y/cell_size.y));
+		int x2=std::min(cols-1,(int)std::floor(bbox.p2.x/cell_size.x));
+		int y2=std::min(rows-1,(int)std::floor(bbox.p2.y/cell_size.y));
+
+		for(int y=y1;y<=y2;y++) {
+			for(int x=x1;x<=x2;x++) {
+				buckets[y*cols+x].push_back(index);
+			}
+		}
+	}
+
+	//items whose bbox intersects some wrapped copy of quad, appended to out once each
+	void query(const Quad& quad,Query& state,SimpleList<T>& out) const {
+		if(entries.empty()) {
+			return;
+		}
+		if(state.stamps.size()!=entries.size()) {
+			state.stamps.assign(entries.size(),0);
+			state.epoch=0;
+		}
+		state.epoch++;
+		if(state.epoch==0) {	//wrapped, reset stamps
+			std::fill(state.stamps.begin(),state.stamps.end(),0);
+			state.epoch=1;
+		}
+
+		int x1=std::floor(quad.p1.x/cell_size.x);
+		int y1=std::floor(quad.p1.y/cell_size.y);
+		int x2=std::floor(quad.p2.x/cell_size.x);
+		int y2=std::floor(quad.p2.y/cell_size.y);
+
+		//quad covers the whole field along an axis, every item matches there
+		bool all_x=(x2-x1+1>=cols);
+		bool all_y=(y2-y1+1>=rows);
+		if(all_x) {
+			x1=0;
+			x2=cols-1;
+		}
+		if(all_y) {
+			y1=0;
+			y2=rows-1;
+		}
+
+		for(int y=y1;y<=y2;y++) {
+			int wrap_y=floor_div(y,rows);
+			float shift_y=wrap_y*field_size.y;
+			const std::vector<int>* row=&buckets[(y-wrap_y*rows)*cols];
+
+			for(int x=x1;x<=x2;x++) {
+				int wrap_x=floor_div(x,cols);
+				float shift_x=wrap_x*field_size.x;
+
+				for(int i : row[x-wrap_x*cols]) {
+					if(state.stamps[i]==state.epoch) {
+						continue;
+					}
+					const Quad& b=entries[i].bbox;
+					//stamp on accept only, another copy of quad may still hit it
+					if(!all_x && (b.p1.x+shift_x>quad.p2.x || b.p2.x+shift_x<quad.p1.x)) {
+						continue;
+					}
+					if(!all_y && (b.p1.y+shift_y>quad.p2.y || b.p2.y+shift_y<quad.p1.y)) {
+						continue;
+					}
+					state.stamps[i]=state.epoch;
+					out.push_back(entries[i].item);
+				}
+			}
+		}
+	}
+	void query(const sf::Vector2f& pos,Query& state,SimpleList<T>& out) const {
+		query(Quad(pos,pos),state,out);
+	}
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define _BGA_UTILS_H_
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <math.h>
 #include <vector>
 #include <cmath>
@@ -17,6 +18,10 @@
 	#define M_PI 3.14159265358979323846
 #endif
 
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
+
 class Utils {
 public:
 	static sf::Vector2i vec_to_i(const sf::Vector2f& v) { return sf::Vector2i(v.x,v.y); }
@@ -104,6 +109,60 @@ public:
 
 
 	static float lerp(float p1,float p2,float x) { return p1+(p2-p1)*x; }
+
+	//bits
+	static int popcount64(uint64_t v) {
+#if defined(_MSC_VER) && defined(_M_X64)
+		return (int)__popcnt64(v);
+#elif defined(_MSC_VER)
+		//no 64 bit intrinsics on 32 bit targets
+		return (int)(__popcnt((unsigned int)v)+__popcnt((unsigned int)(v>>32)));
+#else
+		return __builtin_popcountll(v);
+#endif
+	}
+	//index of lowest set bit, v must not be 0
+	static int ctz64(uint64_t v) {
+#if defined(_MSC_VER) && defined(_M_X64)
+		unsigned long i;
+		_BitScanForward64(&i,v);
+		return (int)i;
+#elif defined(_MSC_VER)
+		unsigned long i;
+		if(_BitScanForward(&i,(unsigned long)v)) {
+			return (int)i;
+		}
+		_BitScanForward(&i,(unsigned long)(v>>32));
+		return (int)i+32;
+#else
+		return __builtin_ctzll(v);
+#endif
+	}
+	//bits [from,to) of a word set, 0<=from<=to<=64
+	static uint64_t bit_range64(int from,int to) {
+		uint64_t hi=(to>=64) ? ~(uint64_t)0 : (((uint64_t)1<<to)-1);
+		uint64_t lo=(from>=64) ? ~(uint64_t)0 : (((uint64_t)1<<from)-1);
+		return hi&~lo;
+	}
+
+	//stateless hashing, for values that must not depend on call order
+	static uint32_t hash32(uint32_t x) {
+		x^=x>>16;
+		x*=0x7feb352d;
+		x^=x>>15;
+		x*=0x846ca68b;
+		x^=x>>16;
+		return x;
+	}
+	static uint32_t hash32(uint32_t a,uint32_t b) {
+		return hash32(a^hash32(b+0x9e3779b9));
+	}
+	//[0,1)
+	static float hash_float(uint32_t h) {
+		return (float)(h>>8)*(1.0f/16777216.0f);
+	}
+	static float hash_range(uint32_t h,float low,float high) { return low+hash_float(h)*(high-low); }
+
 	static int clampi(int low,int high,int val) {
 		if(val<low) return low;
 		if(val>high) return high;
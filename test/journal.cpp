@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Loader.h"
+#include "Terrain.h"
+#include "TerrainJournal.h"
+
+//damage journal round trip: damage, checkpoint, save, load, restore to the middle and the end, compare cells and health
+//run from the repository root, islands load their texture from assets
+
+namespace {
+
+int failures=0;
+
+void check(bool ok,const char* what) {
+	if(!ok) {
+		printf("FAIL %s\n",what);
+		failures++;
+	}
+}
+
+std::vector<uint8_t> read_all(const std::string& path) {
+	std::vector<uint8_t> bytes;
+	FILE* f=fopen(path.c_str(),"rb");
+	if(!f) {
+		return bytes;
+	}
+	fseek(f,0,SEEK_END);
+	bytes.resize(ftell(f));
+	fseek(f,0,SEEK_SET);
+	if(!bytes.empty() && fread(&bytes[0],1,bytes.size(),f)!=bytes.size()) {
+		bytes.clear();
+	}
+	fclose(f);
+	return bytes;
+}
+void write_all(const std::string& path,const std::vector<uint8_t>& bytes) {
+	FILE* f=fopen(path.c_str(),"wb");
+	if(!bytes.empty()) {
+		fwrite(&bytes[0],1,bytes.size(),f);
+	}
+	fclose(f);
+}
+void put32(std::vector<uint8_t>& bytes,uint32_t v) {
+	bytes.insert(bytes.end(),(uint8_t*)&v,(uint8_t*)&v+4);
+}
+
+//state of every damaged island, by island index
+typedef std::map<int,TerrainJournal::IslandState> WorldState;
+
+WorldState damaged_state(Terrain& terrain) {
+	WorldState out;
+	SimpleList<TerrainIsland*> list;
+	ToroidalGrid<TerrainIsland*>::Query query;
+	terrain.list_islands(Quad(sf::Vector2f(0,0),terrain.field_size),query,list);
+	for(int i=0;i<list.size();i++) {
+		if(list[i]->is_damaged()) {
+			list[i]->get_state(out[list[i]->index]);
+		}
+	}
+	return out;
+}
+bool same_state(const WorldState& a,const WorldState& b) {
+	if(a.size()!=b.size()) {
+		return false;
+	}
+	for(WorldState::const_iterator i=a.begin(),j=b.begin();i!=a.end();++i,++j) {
+		if(i->first!=j->first || i->second.cells!=j->second.cells || i->second.health!=j->second.health) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//overlapping hits in one corner of the world, so cells get both destroyed and partly damaged
+void damage_batch(Terrain& terrain,int count) {
+	for(int i=0;i<count;i++) {
+		sf::FloatRect r(Utils::rand_range(0,3000),Utils::rand_range(0,3000),
+				Utils::rand_range(20,120),Utils::rand_range(20,120));
+		terrain.damage_area(r,Utils::rand_range(1,4));
+	}
+}
+
+}
+
+int main() {
+	Loader::init();
+
+	uint32_t seed=777;
+	std::string path="journal_test.bin";
+
+	Terrain world(seed);
+	srand(11);
+	damage_batch(world,150);
+	world.journal_checkpoint();
+	uint32_t checkpoint_position=world.get_journal().get_position();
+	damage_batch(world,150);
+	uint32_t mid=world.get_journal().get_position();
+	WorldState mid_state=damaged_state(world);
+	damage_batch(world,150);
+	uint32_t end=world.get_journal().get_position();
+	WorldState end_state=damaged_state(world);
+
+	check(checkpoint_position>0 && checkpoint_position<mid && mid<end,"damage made entries");
+	check(!mid_state.empty() && !same_state(mid_state,end_state),"damage changed islands");
+
+	check(world.get_journal().save(path),"save");
+	TerrainJournal loaded;
+	check(loaded.load(path),"load");
+	check(loaded.world_seed==seed && loaded.get_position()==end &&
+			loaded.get_checkpoint().position==checkpoint_position,"loaded positions");
+
+	//fresh world, forward to the middle and then to the end
+	Terrain copy(seed);
+	check(!copy.restore(loaded,checkpoint_position-1),"restore before the checkpoint fails");
+	check(copy.restore(loaded,mid) && same_state(damaged_state(copy),mid_state),"restore to the middle");
+	check(copy.restore(loaded,end) && same_state(damaged_state(copy),end_state),"restore to the end");
+
+	int mismatches=0;
+	srand(5);
+	for(int i=0;i<20000;i++) {
+		sf::FloatRect r(Utils::rand_range(0,3200),Utils::rand_range(0,3200),Utils::rand_range(1,30),Utils::rand_range(1,30));
+		if(copy.check_collision(r)!=world.check_collision(r)) {
+			mismatches++;
+		}
+	}
+	check(mismatches==0,"restored occupancy");
+
+	//the damaged world rewinds itself
+	check(world.restore(world.get_journal(),mid) && same_state(damaged_state(world),mid_state),"rewind in place");
+
+	Terrain other(seed+1);
+	check(!other.restore(loaded,mid),"restore into another world fails");
+
+	//broken files, counts are at fixed offsets: header is magic, version, seed, position, island count, entry count
+	//then per island its index, word count and health count
+	std::vector<uint8_t> good=read_all(path);
+	class Case {
+	public:
+		const char* name;
+		std::size_t offset;
+		uint32_t value;
+	};
+	Case cases[]={
+		{"island count",16,0xffffffff},
+		{"entry count",20,0x10000000},
+		{"word count",24+4,0x40000000},
+		{"health count",24+8,0xffffffff},
+	};
+	for(const Case& c : cases) {
+		std::vector<uint8_t> bytes=good;
+		memcpy(&bytes[c.offset],&c.value,4);
+		write_all(path,bytes);
+		TerrainJournal j;
+		if(j.load(path)) {
+			printf("FAIL broken journal accepted: %s\n",c.name);
+			failures++;
+		}
+	}
+	std::vector<uint8_t> truncated(good.begin(),good.end()-1);
+	write_all(path,truncated);
+	check(!TerrainJournal().load(path),"truncated journal rejected");
+	std::vector<uint8_t> trailing=good;
+	trailing.push_back(0);
+	write_all(path,trailing);
+	check(!TerrainJournal().load(path),"trailing bytes rejected");
+
+	//well formed files whose states don't fit the islands load but don't restore
+	uint32_t bad_states[][2]={{0,1},{0xffff,0}};
+	for(int i=0;i<2;i++) {
+		std::vector<uint8_t> bytes;
+		put32(bytes,TerrainJournal::MAGIC);
+		put32(bytes,TerrainJournal::VERSION);
+		put32(bytes,seed);
+		put32(bytes,0);
+		put32(bytes,1);
+		put32(bytes,0);
+		put32(bytes,bad_states[i][0]);
+		put32(bytes,bad_states[i][1]);
+		put32(bytes,0);
+		bytes.resize(bytes.size()+bad_states[i][1]*8,0);
+		write_all(path,bytes);
+		TerrainJournal j;
+		check(j.load(path),"small journal loads");
+		check(!copy.restore(j,0),"state that doesn't fit its island is rejected");
+	}
+	remove(path.c_str());
+
+	if(failures) {
+		printf("%d failures\n",failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
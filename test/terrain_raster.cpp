@@ -0,0 +1,239 @@
+#define GL_GLEXT_PROTOTYPES
+#include <EGL/egl.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Loader.h"
+#include "Terrain.h"
+
+//shader/terrain_raster.frag against the CPU RGBA tiles, pixel for pixel, on a headless EGL context
+//meant for Mesa llvmpipe with EGL_PLATFORM=surfaceless, exits with 77 (skipped) without a usable context
+//run from the repository root for the assets
+
+namespace {
+
+const int skipped=77;
+
+GLuint make_texture(GLint format,int width,int height,GLenum data_format,const sf::Uint8* data,bool repeated) {
+	//on unit 0, noise and material stay bound to theirs
+	GLuint texture;
+	glActiveTexture(GL_TEXTURE0);
+	glGenTextures(1,&texture);
+	glBindTexture(GL_TEXTURE_2D,texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	glTexImage2D(GL_TEXTURE_2D,0,format,width,height,0,data_format,GL_UNSIGNED_BYTE,data);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+	GLint wrap=(repeated ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,wrap);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,wrap);
+	return texture;
+}
+
+GLuint load_program(const std::string& path) {
+	std::ifstream f(path.c_str());
+	std::stringstream ss;
+	ss<<f.rdbuf();
+	std::string source=ss.str();
+	const char* source_ptr=source.c_str();
+
+	GLuint shader=glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(shader,1,&source_ptr,NULL);
+	glCompileShader(shader);
+	GLint ok=0;
+	glGetShaderiv(shader,GL_COMPILE_STATUS,&ok);
+	if(!ok) {
+		char log[4096];
+		glGetShaderInfoLog(shader,sizeof(log),NULL,log);
+		printf("can't compile %s: %s\n",path.c_str(),log);
+		return 0;
+	}
+	GLuint program=glCreateProgram();
+	glAttachShader(program,shader);
+	glLinkProgram(program);
+	glGetProgramiv(program,GL_LINK_STATUS,&ok);
+	if(!ok) {
+		printf("can't link %s\n",path.c_str());
+		return 0;
+	}
+	return program;
+}
+
+//one island through the shader, what SFML does when drawing cell_node, read back as RGBA
+void draw_island(GLuint program,TerrainIsland* island,std::vector<sf::Uint8>& out) {
+	sf::Vector2i count=island->get_cell_count();
+	int pw=count.x*island->cell_size;
+	int ph=count.y*island->cell_size;
+
+	const BitGrid& cells=island->get_cells();
+	std::vector<sf::Uint8> cell_map(count.x*count.y);
+	for(int y=0;y<count.y;y++) {
+		for(int x=0;x<count.x;x++) {
+			cell_map[y*count.x+x]=(cells.get(x,y) ? 255 : 0);
+		}
+	}
+	GLuint cell_texture=make_texture(GL_ALPHA8,count.x,count.y,GL_ALPHA,&cell_map[0],false);
+
+	GLuint target=make_texture(GL_RGBA8,pw,ph,GL_RGBA,NULL,false);
+	GLuint framebuffer;
+	glGenFramebuffers(1,&framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER,framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,GL_TEXTURE_2D,target,0);
+
+	glViewport(0,0,pw,ph);
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glOrtho(0,pw,0,ph,-1,1);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D,cell_texture);
+	glUniform2f(glGetUniformLocation(program,"cell_count"),count.x,count.y);
+	sf::Vector2i noise_offset=island->get_noise_offset();
+	glUniform2f(glGetUniformLocation(program,"noise_offset"),noise_offset.x,noise_offset.y);
+
+	glClearColor(0,0,0,0);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glBegin(GL_QUADS);
+	glColor4f(1,1,1,1);
+	glTexCoord2f(0,0);
+	glVertex2f(0,0);
+	glTexCoord2f(1,0);
+	glVertex2f(pw,0);
+	glTexCoord2f(1,1);
+	glVertex2f(pw,ph);
+	glTexCoord2f(0,1);
+	glVertex2f(0,ph);
+	glEnd();
+
+	out.resize(pw*ph*4);
+	glPixelStorei(GL_PACK_ALIGNMENT,1);
+	glReadPixels(0,0,pw,ph,GL_RGBA,GL_UNSIGNED_BYTE,&out[0]);
+
+	glBindFramebuffer(GL_FRAMEBUFFER,0);
+	glDeleteFramebuffers(1,&framebuffer);
+	glDeleteTextures(1,&target);
+	glDeleteTextures(1,&cell_texture);
+}
+
+}
+
+int main() {
+	EGLDisplay display=eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	EGLint major,minor;
+	if(display==EGL_NO_DISPLAY || !eglInitialize(display,&major,&minor) || !eglBindAPI(EGL_OPENGL_API)) {
+		printf("no EGL display, skipped\n");
+		return skipped;
+	}
+	EGLint attributes[]={EGL_RENDERABLE_TYPE,EGL_OPENGL_BIT,EGL_NONE};
+	EGLConfig config=NULL;
+	EGLint config_count=0;
+	eglChooseConfig(display,attributes,&config,1,&config_count);
+	EGLContext context=eglCreateContext(display,config_count ? config : NULL,EGL_NO_CONTEXT,NULL);
+	if(context==EGL_NO_CONTEXT || !eglMakeCurrent(display,EGL_NO_SURFACE,EGL_NO_SURFACE,context)) {
+		printf("no surfaceless GL context, skipped\n");
+		return skipped;
+	}
+	printf("GL %s, %s\n",glGetString(GL_VERSION),glGetString(GL_RENDERER));
+
+	GLuint program=load_program("assets/shader/terrain_raster.frag");
+	if(!program) {
+		return 1;
+	}
+
+	Loader::init();
+	Terrain terrain(7);
+	terrain.generate_all();
+
+	SimpleList<TerrainIsland*> islands;
+	ToroidalGrid<TerrainIsland*>::Query query;
+	terrain.list_islands(Quad(sf::Vector2f(0,0),terrain.field_size),query,islands);
+	if(!islands.size()) {
+		printf("no islands\n");
+		return 1;
+	}
+
+	//shared textures and parameters, as set up by TerrainIsland::init_pixel_format
+	std::vector<sf::Uint8> noise;
+	sf::Vector2u noise_size=TerrainIsland::noise_texels(noise);
+	GLuint noise_texture=make_texture(GL_RGBA8,noise_size.x,noise_size.y,GL_RGBA,&noise[0],true);
+
+	sf::Image* material=Loader::get_image("terrain/texture.png");
+	GLuint material_texture=make_texture(GL_RGBA8,material->getSize().x,material->getSize().y,GL_RGBA,
+			material->getPixelsPtr(),true);
+
+	TerrainIsland* first=islands[0];
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program,"texture"),0);
+	glUniform1i(glGetUniformLocation(program,"noise"),1);
+	glUniform1i(glGetUniformLocation(program,"material"),2);
+	glUniform2f(glGetUniformLocation(program,"noise_size"),noise_size.x,noise_size.y);
+	glUniform2f(glGetUniformLocation(program,"material_size"),material->getSize().x,material->getSize().y);
+	glUniform1f(glGetUniformLocation(program,"cell_size"),first->cell_size);
+	glUniform1f(glGetUniformLocation(program,"light_weight"),first->get_light_weight().x);
+	glUniform1f(glGetUniformLocation(program,"light_limit"),first->get_light_limit());
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D,noise_texture);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D,material_texture);
+
+	//a spread of islands, one of them damaged so destroyed cells are covered too
+	long pixels=0;
+	long coverage_mismatches=0;
+	int max_diff=0;
+	for(int i=0;i<islands.size();i+=37) {
+		TerrainIsland* island=islands[i];
+		if(i==74) {
+			island->damage_area(sf::FloatRect(100,100,120,60),100);
+		}
+		sf::Vector2i count=island->get_cell_count();
+		int pw=count.x*island->cell_size;
+		int ph=count.y*island->cell_size;
+
+		ImageData cpu;
+		if(!island->raster_reference(sf::IntRect(0,0,pw,ph),cpu)) {
+			printf("no reference raster for island %d\n",island->index);
+			return 1;
+		}
+		std::vector<sf::Uint8> gpu;
+		draw_island(program,island,gpu);
+
+		for(int p=0;p<pw*ph;p++) {
+			const sf::Uint8* c=cpu.data+p*4;
+			const sf::Uint8* g=&gpu[p*4];
+			pixels++;
+			if((c[3]!=0)!=(g[3]!=0)) {
+				coverage_mismatches++;
+				continue;
+			}
+			if(!c[3]) {
+				continue;
+			}
+			for(int k=0;k<3;k++) {
+				max_diff=std::max(max_diff,abs((int)g[k]-(int)c[k]));
+			}
+		}
+	}
+	printf("pixels %ld coverage mismatches %ld max rgb diff %d\n",pixels,coverage_mismatches,max_diff);
+
+	eglMakeCurrent(display,EGL_NO_SURFACE,EGL_NO_SURFACE,EGL_NO_CONTEXT);
+	eglDestroyContext(display,context);
+	eglTerminate(display);
+
+	if(coverage_mismatches || max_diff) {
+		printf("FAIL gpu raster differs from the tiles\n");
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
@@ -130,7 +130,7 @@ public:
 			laser.rotation-=dt*0.1;
 		}
 
-		terrain.update_visual(sf::FloatRect(-node.pos,size));
+		terrain.update_visual(sf::FloatRect(-node.pos,size),sf::Vector2f(0,0),dt);
 
 		laser.pos=pointer_pos;
 
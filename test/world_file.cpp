@@ -0,0 +1,262 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <SFML/System.hpp>
+
+#include "Loader.h"
+#include "Terrain.h"
+#include "TerrainWorldFile.h"
+
+//world file format round trip, validation of broken files and the background bake against plain generation
+//run from the repository root, islands load their texture from assets
+
+namespace {
+
+int failures=0;
+
+void check(bool ok,const char* what) {
+	if(!ok) {
+		printf("FAIL %s\n",what);
+		failures++;
+	}
+}
+
+std::vector<uint8_t> read_all(const std::string& path) {
+	std::vector<uint8_t> bytes;
+	FILE* f=fopen(path.c_str(),"rb");
+	if(!f) {
+		return bytes;
+	}
+	fseek(f,0,SEEK_END);
+	bytes.resize(ftell(f));
+	fseek(f,0,SEEK_SET);
+	if(!bytes.empty() && fread(&bytes[0],1,bytes.size(),f)!=bytes.size()) {
+		bytes.clear();
+	}
+	fclose(f);
+	return bytes;
+}
+void write_all(const std::string& path,const std::vector<uint8_t>& bytes) {
+	FILE* f=fopen(path.c_str(),"wb");
+	if(!bytes.empty()) {
+		fwrite(&bytes[0],1,bytes.size(),f);
+	}
+	fclose(f);
+}
+
+uint64_t random_word(uint32_t& state) {
+	uint64_t hi=(state=Utils::hash32(state,1));
+	uint64_t lo=(state=Utils::hash32(state,2));
+	return (hi<<32)|lo;
+}
+
+//writes a small synthetic world, maps it back and compares every field and word
+void test_round_trip(const std::string& path) {
+	uint32_t state=7;
+
+	TerrainWorldFile::Header header;
+	header.world_seed=1234;
+	header.field_w=1000;
+	header.field_h=500;
+	header.occupancy_w=70;
+	header.occupancy_h=33;
+	header.occupancy_stride=2;
+
+	//widths around the 64 bit word boundary
+	int sizes[][2]={{1,1},{63,5},{64,7},{65,3},{130,2}};
+	std::vector<TerrainWorldFile::Island> islands;
+	std::vector<std::vector<uint64_t> > words;
+	for(int i=0;i<5;i++) {
+		TerrainWorldFile::Island island;
+		island.x1=i*10;
+		island.y1=i*20;
+		island.x2=i*10+5;
+		island.y2=i*20+7;
+		island.seed=100+i;
+		island.w=sizes[i][0];
+		island.h=sizes[i][1];
+		island.stride=(island.w+63)/64;
+		island.cells_offset=0;
+		islands.push_back(island);
+
+		std::vector<uint64_t> cells(island.stride*island.h);
+		for(uint64_t& word : cells) {
+			word=random_word(state);
+		}
+		words.push_back(cells);
+	}
+	std::vector<const uint64_t*> cells;
+	for(const std::vector<uint64_t>& w : words) {
+		cells.push_back(&w[0]);
+	}
+	std::vector<uint64_t> occupancy(header.occupancy_stride*header.occupancy_h);
+	for(uint64_t& word : occupancy) {
+		word=random_word(state);
+	}
+
+	check(TerrainWorldFile::write(path,header,islands,cells,&occupancy[0]),"write");
+
+	TerrainWorldFile file;
+	check(file.open(path),"open written file");
+	if(!file.is_open()) {
+		return;
+	}
+	const TerrainWorldFile::Header& h=file.get_header();
+	check(h.world_seed==header.world_seed && h.island_count==islands.size() &&
+			h.field_w==header.field_w && h.field_h==header.field_h &&
+			h.occupancy_w==header.occupancy_w && h.occupancy_h==header.occupancy_h &&
+			h.occupancy_stride==header.occupancy_stride,"header fields");
+	for(int i=0;i<(int)islands.size();i++) {
+		const TerrainWorldFile::Island& island=file.get_island(i);
+		check(island.x1==islands[i].x1 && island.y1==islands[i].y1 &&
+				island.x2==islands[i].x2 && island.y2==islands[i].y2 &&
+				island.seed==islands[i].seed && island.w==islands[i].w &&
+				island.h==islands[i].h && island.stride==islands[i].stride,"island table");
+		check((island.cells_offset&7)==0,"cells aligned");
+		check(memcmp(file.get_words(island.cells_offset),&words[i][0],words[i].size()*8)==0,"island cells");
+	}
+	check(memcmp(file.get_words(h.occupancy_offset),&occupancy[0],occupancy.size()*8)==0,"occupancy");
+
+	//damage writes go to the private copy only
+	file.get_words(file.get_island(0).cells_offset)[0]^=1;
+	file.close();
+	TerrainWorldFile again;
+	check(again.open(path) && memcmp(again.get_words(again.get_island(0).cells_offset),&words[0][0],8)==0,
+			"mapping is copy on write");
+}
+
+//each broken copy of a good file has to be rejected by open()
+void test_validate(const std::string& path) {
+	std::vector<uint8_t> good=read_all(path);
+	check(good.size()>sizeof(TerrainWorldFile::Header),"good file for validation");
+	if(good.size()<=sizeof(TerrainWorldFile::Header)) {
+		return;
+	}
+	std::string broken_path=path+".broken";
+
+	class Case {
+	public:
+		const char* name;
+		std::size_t offset;	//byte to overwrite, or the size to truncate to
+		uint32_t value;
+		bool truncate;
+	};
+	std::size_t table=sizeof(TerrainWorldFile::Header);
+	std::size_t island=sizeof(TerrainWorldFile::Island);
+	Case cases[]={
+		{"magic",offsetof(TerrainWorldFile::Header,magic),0x12345678,false},
+		{"version",offsetof(TerrainWorldFile::Header,version),TerrainWorldFile::VERSION+1,false},
+		{"island count",offsetof(TerrainWorldFile::Header,island_count),0x10000000,false},
+		{"occupancy stride",offsetof(TerrainWorldFile::Header,occupancy_stride),1,false},
+		{"occupancy height",offsetof(TerrainWorldFile::Header,occupancy_h),0x7fffffff,false},
+		{"occupancy offset",offsetof(TerrainWorldFile::Header,occupancy_offset),(uint32_t)good.size(),false},
+		{"occupancy alignment",offsetof(TerrainWorldFile::Header,occupancy_offset),(uint32_t)table+4,false},
+		{"island width",table+island+offsetof(TerrainWorldFile::Island,w),0,false},
+		{"island stride",table+island+offsetof(TerrainWorldFile::Island,stride),5,false},
+		{"island height",table+island+offsetof(TerrainWorldFile::Island,h),0x7fffffff,false},
+		{"cells offset",table+island+offsetof(TerrainWorldFile::Island,cells_offset),(uint32_t)good.size(),false},
+		{"cells in table",table+island+offsetof(TerrainWorldFile::Island,cells_offset),(uint32_t)table,false},
+		{"truncated",good.size()-8,0,true},
+		{"header only",sizeof(TerrainWorldFile::Header)-1,0,true},
+	};
+	for(const Case& c : cases) {
+		std::vector<uint8_t> bytes=good;
+		if(c.truncate) {
+			bytes.resize(c.offset);
+		}
+		else {
+			memcpy(&bytes[c.offset],&c.value,4);
+		}
+		write_all(broken_path,bytes);
+		TerrainWorldFile file;
+		if(file.open(broken_path)) {
+			printf("FAIL broken file accepted: %s\n",c.name);
+			failures++;
+		}
+	}
+	remove(broken_path.c_str());
+
+	check(!TerrainWorldFile::writable("no/such/dir/world.cache"),"missing directory isn't writable");
+	check(TerrainWorldFile::writable(broken_path),"temp path is writable");
+	check(read_all(broken_path).empty() && read_all(broken_path+".tmp").empty(),"writable leaves nothing behind");
+}
+
+//bakes a world in the background while it's being damaged, the file must hold the generated cells
+void test_bake(const std::string& path) {
+	uint32_t seed=4321;
+	remove(path.c_str());
+
+	Terrain baked(seed);
+	check(!baked.open_world_file(path),"miss reported");
+	check(baked.is_baking(),"bake started");
+	srand(3);
+	for(int i=0;i<200;i++) {
+		sf::FloatRect r(Utils::rand_range(0,baked.field_size.x),Utils::rand_range(0,baked.field_size.y),60,60);
+		baked.damage_area(r,1000);
+	}
+	sf::Clock clock;
+	while(baked.is_baking() && clock.getElapsedTime().asSeconds()<120) {
+		sf::sleep(sf::milliseconds(10));
+	}
+	check(!baked.is_baking(),"bake finished");
+
+	Terrain mapped(seed);
+	check(mapped.open_world_file(path),"baked file maps");
+	Terrain generated(seed);
+	generated.generate_all();
+
+	//same layout on both sides, islands come back in the same order
+	Quad field(sf::Vector2f(0,0),generated.field_size);
+	SimpleList<TerrainIsland*> l1,l2;
+	ToroidalGrid<TerrainIsland*>::Query q1,q2;
+	mapped.list_islands(field,q1,l1);
+	generated.list_islands(field,q2,l2);
+	check(l1.size()==l2.size() && l1.size()>0,"island count");
+	int differing=0;
+	for(int i=0;i<l1.size() && i<l2.size();i++) {
+		const BitGrid& a=l1[i]->get_cells();
+		const BitGrid& b=l2[i]->get_cells();
+		if(l1[i]->get_seed()!=l2[i]->get_seed() || a.w!=b.w || a.h!=b.h ||
+				memcmp(a.words,b.words,a.stride*a.h*8)!=0) {
+			differing++;
+		}
+	}
+	check(differing==0,"baked cells match generation");
+
+	//occupancy through the coarse rect test
+	int mismatches=0;
+	srand(5);
+	for(int i=0;i<20000;i++) {
+		sf::FloatRect r(Utils::rand_range(0,mapped.field_size.x),Utils::rand_range(0,mapped.field_size.y),
+				Utils::rand_range(1,40),Utils::rand_range(1,40));
+		if(mapped.check_collision(r)!=generated.check_collision(r)) {
+			mismatches++;
+		}
+	}
+	check(mismatches==0,"baked occupancy matches generation");
+}
+
+}
+
+int main() {
+	Loader::init();
+
+	std::string path="world_file_test.cache";
+	test_round_trip(path);
+	test_validate(path);
+	remove(path.c_str());
+
+	test_bake(path);
+	remove(path.c_str());
+
+	if(failures) {
+		printf("%d failures\n",failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}